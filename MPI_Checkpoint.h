@@ -0,0 +1,219 @@
+/*Checkpoints of a streaming run
+-> A streaming run pushes every rank's elements through the pipeline in batches, batch b holds elements
+   [b * batch_elements, (b + 1) * batch_elements) of every rank, so after b batches every rank has the results of a known prefix (its watermark)
+-> Every rank keeps two files:
+    -> <path>.<rank>          - the manifest, see checkpoint_manifest: batches done, watermark, checksum of the results prefix and
+                                what is needed to rebuild the same input and plan on restart
+    -> <path>.<rank>.results  - the results of the watermark prefix as raw floats, only ever appended to
+-> Checkpoints are written by a background thread: the new results are appended and synced first, then the new manifest is written to a
+   temporary file and renamed over the old one, so a manifest never points at results that are not on disk
+-> Ranks checkpoint independently, on restart they agree on the smallest number of batches every rank has completed (the last
+   consistent watermark), cut their results files back to it and continue the stream from the next batch
+*/
+
+#ifndef MPI_CHECKPOINT_H
+#define MPI_CHECKPOINT_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include "MPI_ResultFile.h"
+
+
+const char checkpoint_magic[8] = { 'M', 'P', 'I', 'C', 'K', 'P', 'N', 'T' };
+const uint32_t checkpoint_version = 1;
+
+struct checkpoint_manifest
+{
+    char magic[8];
+    uint32_t version;
+    // Generation options of the input (unused for --input runs)
+    uint32_t seed;
+    int32_t max_elements;
+    int32_t distribution;
+    // The plan: this rank's element count, the batch size and a hash of all ranks' counts
+    uint64_t total_ranks;
+    uint64_t element_count;
+    uint64_t batch_elements;
+    uint64_t plan_hash;
+    // Progress: results [0, watermark) are in the results file after batches_done batches
+    uint64_t batches_done;
+    uint64_t watermark;
+    uint64_t results_checksum;
+};
+
+static_assert(sizeof(checkpoint_manifest) == 80, "checkpoint layout must not depend on padding");
+
+
+// FNV-1a over every rank's element count and the batch size, the batches of a stream depend on nothing else
+inline uint64_t stream_plan_hash(const std::vector<int>& counts, uint64_t batch_elements)
+{
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (int count : counts)
+    {
+        hash = (hash ^ (uint32_t) count) * 0x100000001B3ull;
+    }
+    return (hash ^ batch_elements) * 0x100000001B3ull;
+}
+
+inline std::string checkpoint_manifest_path(const std::string& path, int rank)
+{
+    return path + "." + std::to_string(rank);
+}
+
+inline std::string checkpoint_results_path(const std::string& path, int rank)
+{
+    return checkpoint_manifest_path(path, rank) + ".results";
+}
+
+inline bool write_all(int descriptor, const void* data, size_t size)
+{
+    const char* position = (const char*) data;
+    while (size > 0)
+    {
+        ssize_t written = write(descriptor, position, size);
+        if (written <= 0)
+        {
+            return false;
+        }
+        position += written;
+        size -= written;
+    }
+    return true;
+}
+
+
+// Read and check the manifest of rank, returns false when there is none or it is not a valid manifest
+inline bool read_checkpoint(const std::string& path, int rank, checkpoint_manifest& manifest)
+{
+    FILE* file = fopen(checkpoint_manifest_path(path, rank).c_str(), "rb");
+    if (file == NULL)
+    {
+        return false;
+    }
+    bool valid = fread(&manifest, sizeof(manifest), 1, file) == 1 && memcmp(manifest.magic, checkpoint_magic, sizeof(manifest.magic)) == 0 &&
+        manifest.version == checkpoint_version && manifest.watermark <= manifest.element_count;
+    fclose(file);
+    return valid;
+}
+
+// Read the manifest's results prefix into results (room for manifest.watermark floats), returns false when the results file
+// is shorter than the watermark or does not match the manifest's checksum
+inline bool restore_checkpoint(const std::string& path, int rank, const checkpoint_manifest& manifest, float* results)
+{
+    if (manifest.watermark == 0)
+    {
+        return true;
+    }
+    FILE* file = fopen(checkpoint_results_path(path, rank).c_str(), "rb");
+    if (file == NULL)
+    {
+        return false;
+    }
+    bool valid = fread(results, sizeof(float), manifest.watermark, file) == manifest.watermark &&
+        result_block_checksum(results, manifest.watermark) == manifest.results_checksum;
+    fclose(file);
+    return valid;
+}
+
+
+// Replace the manifest of rank: write and sync a temporary file, then rename it over the old manifest
+inline bool write_manifest(const std::string& path, int rank, const checkpoint_manifest& manifest)
+{
+    std::string manifest_path = checkpoint_manifest_path(path, rank);
+    std::string temporary_path = manifest_path + ".tmp";
+
+    int descriptor = open(temporary_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool written = descriptor >= 0 && write_all(descriptor, &manifest, sizeof(manifest)) && fsync(descriptor) == 0;
+    written = (descriptor < 0 || close(descriptor) == 0) && written;
+    return written && rename(temporary_path.c_str(), manifest_path.c_str()) == 0;
+}
+
+
+struct checkpoint_writer
+{
+    std::string path;
+    int rank = 0;
+    // Last committed checkpoint, only the background thread changes it and only while it runs
+    checkpoint_manifest manifest;
+    const float* results = nullptr;
+    std::thread thread;
+    bool failed = false;
+    int checkpoints = 0;
+};
+
+// Background part of a checkpoint: append results [manifest.watermark, watermark), sync, then replace the manifest
+inline void write_checkpoint_files(checkpoint_writer* writer, uint64_t batches_done, uint64_t watermark)
+{
+    // After a failure the results file no longer ends at the committed watermark, keep the last good checkpoint instead
+    if (writer->failed)
+    {
+        return;
+    }
+
+    checkpoint_manifest next = writer->manifest;
+    uint64_t count = watermark - next.watermark;
+    const float* results = writer->results + next.watermark;
+    next.batches_done = batches_done;
+    next.watermark = watermark;
+    next.results_checksum = result_block_checksum(results, count, next.results_checksum);
+
+    int descriptor = open(checkpoint_results_path(writer->path, writer->rank).c_str(), O_WRONLY | O_APPEND);
+    bool written = descriptor >= 0 && write_all(descriptor, results, count * sizeof(float)) && fsync(descriptor) == 0;
+    written = (descriptor < 0 || close(descriptor) == 0) && written;
+    written = written && write_manifest(writer->path, writer->rank, next);
+
+    if (written)
+    {
+        writer->manifest = next;
+        writer->checkpoints++;
+    }
+    writer->failed = writer->failed || !written;
+}
+
+// Prepare checkpoints continuing from manifest (a fresh run passes a manifest with watermark 0): the manifest is written first, then
+// the results file is cut back to its watermark, so a crash in between still leaves a valid checkpoint
+// results must stay valid up to every watermark passed to start_checkpoint until finish_checkpoints
+inline bool open_checkpoints(checkpoint_writer& writer, const std::string& path, int rank, const checkpoint_manifest& manifest, const float* results)
+{
+    writer.path = path;
+    writer.rank = rank;
+    writer.manifest = manifest;
+    writer.results = results;
+
+    if (!write_manifest(path, rank, manifest))
+    {
+        return false;
+    }
+    int descriptor = open(checkpoint_results_path(path, rank).c_str(), O_WRONLY | O_CREAT, 0644);
+    bool opened = descriptor >= 0 && ftruncate(descriptor, manifest.watermark * sizeof(float)) == 0;
+    return (descriptor < 0 || close(descriptor) == 0) && opened;
+}
+
+// Start writing the checkpoint of batches_done batches with results [0, watermark) in the background
+// Only one checkpoint is in flight at a time, so this first waits for the previous one
+inline void start_checkpoint(checkpoint_writer& writer, uint64_t batches_done, uint64_t watermark)
+{
+    if (writer.thread.joinable())
+    {
+        writer.thread.join();
+    }
+    writer.thread = std::thread(write_checkpoint_files, &writer, batches_done, watermark);
+}
+
+// Wait for the last checkpoint, returns false if any checkpoint could not be written
+inline bool finish_checkpoints(checkpoint_writer& writer)
+{
+    if (writer.thread.joinable())
+    {
+        writer.thread.join();
+    }
+    return !writer.failed;
+}
+
+#endif
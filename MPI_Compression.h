@@ -0,0 +1,572 @@
+/*Payload compression for the redistribution exchanges
+-> Every message is a block of 32-bit words (the int elements or the float results)
+-> A compressed message is one codec byte followed by the codec's payload, so the receiver never needs to know which codec was chosen
+-> Codecs:
+    -> raw           - the words unchanged (used for small or incompressible messages)
+    -> delta         - difference to the previous word, zigzag encoded and written as a varint (1 byte for |delta| < 64)
+    -> rle           - runs of identical words written as (varint run length, word)
+    -> lz            - LZ4-style byte compressor: literal runs and back references into a 64 KB window
+-> A message is only sent compressed when it is at least min_bytes long and the codec reaches min_ratio, otherwise it goes out raw
+-> With adaptive settings calibrate_compression measures the link bandwidth to root for intra-node and inter-node peers and the
+   codecs' throughput and ratio, then picks per peer the codec (or raw) with the lowest predicted transfer time
+*/
+
+#ifndef MPI_COMPRESSION_H
+#define MPI_COMPRESSION_H
+
+#include <mpi.h>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+
+
+enum codec_id : uint8_t { CODEC_RAW = 0, CODEC_DELTA = 1, CODEC_RLE = 2, CODEC_LZ = 3 };
+
+const char* const codec_names[] = { "raw", "delta", "rle", "lz" };
+
+
+struct compression_settings
+{
+    codec_id codec = CODEC_RAW;
+    int min_bytes = 4096;      // smaller messages are always sent raw
+    double min_ratio = 1.1;    // raw size / compressed size needed to send a message compressed
+    bool adaptive = false;     // codec chosen per peer by calibrate_compression
+
+    // When not empty, the codec for messages between root and each rank of the communicator (overrides codec)
+    std::vector<codec_id> peer_codec;
+};
+
+// Settings for the messages between root and peer
+inline compression_settings settings_for_peer(const compression_settings& settings, int peer)
+{
+    compression_settings peer_settings = settings;
+    if (!settings.peer_codec.empty())
+    {
+        peer_settings.codec = settings.peer_codec[peer];
+    }
+    return peer_settings;
+}
+
+// Bytes handed to and put on the wire by the compressed exchanges of one rank
+struct compression_statistics
+{
+    long long raw_bytes = 0;
+    long long wire_bytes = 0;
+    long long compressed_messages = 0;
+    long long raw_messages = 0;
+};
+
+
+// Varint (LEB128) helpers, readers return false instead of reading past the end of the input
+inline void write_varint(std::vector<uint8_t>& out, uint32_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back((uint8_t) (value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((uint8_t) value);
+}
+
+inline bool read_varint(const uint8_t*& in, const uint8_t* end, uint32_t& value)
+{
+    value = 0;
+    for (int shift = 0; shift < 35 && in < end; shift += 7)
+    {
+        uint8_t byte = *in++;
+        value |= (uint32_t) (byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+inline void encode_delta(const uint32_t* words, int count, std::vector<uint8_t>& out)
+{
+    uint32_t previous = 0;
+    for (int i = 0; i < count; i++)
+    {
+        int32_t delta = (int32_t) (words[i] - previous);
+        write_varint(out, ((uint32_t) delta << 1) ^ (uint32_t) (delta >> 31));
+        previous = words[i];
+    }
+}
+
+inline bool decode_delta(const uint8_t* in, const uint8_t* end, uint32_t* words, int count)
+{
+    uint32_t previous = 0;
+    for (int i = 0; i < count; i++)
+    {
+        uint32_t zigzag;
+        if (!read_varint(in, end, zigzag))
+        {
+            return false;
+        }
+        previous += (zigzag >> 1) ^ (0u - (zigzag & 1));
+        words[i] = previous;
+    }
+    return in == end;
+}
+
+
+inline void encode_rle(const uint32_t* words, int count, std::vector<uint8_t>& out)
+{
+    for (int i = 0; i < count;)
+    {
+        int run = 1;
+        while (i + run < count && words[i + run] == words[i])
+        {
+            run++;
+        }
+        write_varint(out, run);
+        const uint8_t* bytes = (const uint8_t*) &words[i];
+        out.insert(out.end(), bytes, bytes + sizeof(uint32_t));
+        i += run;
+    }
+}
+
+inline bool decode_rle(const uint8_t* in, const uint8_t* end, uint32_t* words, int count)
+{
+    for (int i = 0; i < count;)
+    {
+        uint32_t run;
+        uint32_t word;
+        if (!read_varint(in, end, run) || run == 0 || run > (uint32_t) (count - i) || end - in < (long) sizeof(word))
+        {
+            return false;
+        }
+        memcpy(&word, in, sizeof(word));
+        in += sizeof(word);
+        for (uint32_t j = 0; j < run; j++)
+        {
+            words[i++] = word;
+        }
+    }
+    return in == end;
+}
+
+
+// Sequences of (varint literal length, literals, varint match length, varint match offset), matches are at least
+// lz_min_match bytes and a match length of 0 ends the stream after its literals
+const int lz_min_match = 4;
+const int lz_hash_bits = 12;
+const int lz_max_offset = 65535;
+
+inline void encode_lz(const uint8_t* bytes, int size, std::vector<uint8_t>& out)
+{
+    std::vector<int> last_position(1 << lz_hash_bits, -1);
+    int literal_start = 0;
+    int i = 0;
+
+    while (i + lz_min_match <= size)
+    {
+        uint32_t sequence;
+        memcpy(&sequence, bytes + i, sizeof(sequence));
+        uint32_t hash = (sequence * 2654435761u) >> (32 - lz_hash_bits);
+        int candidate = last_position[hash];
+        last_position[hash] = i;
+
+        if (candidate < 0 || i - candidate > lz_max_offset || memcmp(bytes + candidate, bytes + i, lz_min_match) != 0)
+        {
+            i++;
+            continue;
+        }
+
+        int length = lz_min_match;
+        while (i + length < size && bytes[candidate + length] == bytes[i + length])
+        {
+            length++;
+        }
+
+        write_varint(out, i - literal_start);
+        out.insert(out.end(), bytes + literal_start, bytes + i);
+        write_varint(out, length);
+        write_varint(out, i - candidate);
+
+        i += length;
+        literal_start = i;
+    }
+
+    write_varint(out, size - literal_start);
+    out.insert(out.end(), bytes + literal_start, bytes + size);
+    write_varint(out, 0);
+}
+
+inline bool decode_lz(const uint8_t* in, const uint8_t* end, uint8_t* bytes, int size)
+{
+    int position = 0;
+    while (true)
+    {
+        uint32_t literals;
+        uint32_t length;
+        if (!read_varint(in, end, literals) || literals > (uint32_t) (size - position) || end - in < (long) literals)
+        {
+            return false;
+        }
+        if (literals > 0)
+        {
+            memcpy(bytes + position, in, literals);
+        }
+        in += literals;
+        position += literals;
+
+        if (!read_varint(in, end, length))
+        {
+            return false;
+        }
+        if (length == 0)
+        {
+            return position == size && in == end;
+        }
+
+        uint32_t offset;
+        if (!read_varint(in, end, offset) || offset == 0 || offset > (uint32_t) position || length > (uint32_t) (size - position))
+        {
+            return false;
+        }
+        // Byte by byte so overlapping matches repeat the pattern
+        for (uint32_t j = 0; j < length; j++, position++)
+        {
+            bytes[position] = bytes[position - offset];
+        }
+    }
+}
+
+
+// Encode count 32-bit words into out (codec byte + payload), falling back to raw below the size or ratio thresholds
+inline codec_id compress_words(const void* data, int count, const compression_settings& settings, std::vector<uint8_t>& out)
+{
+    const uint32_t* words = (const uint32_t*) data;
+    int raw_bytes = count * sizeof(uint32_t);
+
+    out.clear();
+    if (settings.codec != CODEC_RAW && raw_bytes >= settings.min_bytes)
+    {
+        out.push_back(settings.codec);
+        switch (settings.codec)
+        {
+            case CODEC_DELTA: encode_delta(words, count, out); break;
+            case CODEC_RLE:   encode_rle(words, count, out); break;
+            default:          encode_lz((const uint8_t*) data, raw_bytes, out); break;
+        }
+
+        if (out.size() * settings.min_ratio <= raw_bytes)
+        {
+            return settings.codec;
+        }
+        out.clear();
+    }
+
+    out.push_back(CODEC_RAW);
+    const uint8_t* bytes = (const uint8_t*) data;
+    out.insert(out.end(), bytes, bytes + raw_bytes);
+    return CODEC_RAW;
+}
+
+// Decode a message produced by compress_words into exactly count words, returns false for corrupt input
+inline bool decompress_words(const uint8_t* in, int size, void* data, int count)
+{
+    if (size < 1)
+    {
+        return count == 0 && size == 0;
+    }
+
+    const uint8_t* end = in + size;
+    codec_id codec = (codec_id) *in++;
+    switch (codec)
+    {
+        case CODEC_RAW:
+            if (end - in != (long) count * (long) sizeof(uint32_t))
+            {
+                return false;
+            }
+            if (count > 0)
+            {
+                memcpy(data, in, count * sizeof(uint32_t));
+            }
+            return true;
+        case CODEC_DELTA: return decode_delta(in, end, (uint32_t*) data, count);
+        case CODEC_RLE:   return decode_rle(in, end, (uint32_t*) data, count);
+        case CODEC_LZ:    return decode_lz(in, end, (uint8_t*) data, count * sizeof(uint32_t));
+        default:          return false;
+    }
+}
+
+
+inline void count_message(compression_statistics& statistics, int raw_bytes, int wire_bytes, codec_id codec)
+{
+    statistics.raw_bytes += raw_bytes;
+    statistics.wire_bytes += wire_bytes;
+    (codec == CODEC_RAW ? statistics.raw_messages : statistics.compressed_messages)++;
+}
+
+inline void abort_on_corrupt_message(bool decoded, int my_rank, int source)
+{
+    if (!decoded)
+    {
+        fprintf(stderr, "Rank %d received a corrupt compressed message from rank %d\n", my_rank, source);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+}
+
+
+// MPI_Gatherv of 32-bit words where every rank's contribution is compressed on its own (collective)
+// counts and displacements are in words and only needed on root, like for MPI_Gatherv
+inline void compressed_gatherv(const void* send_data, int send_count, void* receive_data, const int* counts, const int* displacements,
+    int root, MPI_Comm comm, const compression_settings& settings, compression_statistics& statistics)
+{
+    int my_rank;
+    int total_ranks;
+    MPI_Comm_rank(comm, &my_rank);
+    MPI_Comm_size(comm, &total_ranks);
+
+    std::vector<uint8_t> message;
+    codec_id codec = compress_words(send_data, send_count, settings_for_peer(settings, my_rank), message);
+    count_message(statistics, send_count * sizeof(uint32_t), message.size(), codec);
+
+    // Compressed sizes differ from the word counts, so root needs them before the byte-wise MPI_Gatherv
+    int message_size = message.size();
+    std::vector<int> message_sizes(my_rank == root ? total_ranks : 0);
+    MPI_Gather(&message_size, 1, MPI_INT, message_sizes.data(), 1, MPI_INT, root, comm);
+
+    std::vector<int> message_displacements;
+    std::vector<uint8_t> received;
+    if (my_rank == root)
+    {
+        message_displacements.resize(total_ranks, 0);
+        for (int i = 1; i < total_ranks; i++)
+        {
+            message_displacements[i] = message_displacements[i - 1] + message_sizes[i - 1];
+        }
+        received.resize(message_displacements[total_ranks - 1] + message_sizes[total_ranks - 1]);
+    }
+
+    MPI_Gatherv(message.data(), message_size, MPI_BYTE, received.data(), message_sizes.data(), message_displacements.data(), MPI_BYTE, root, comm);
+
+    if (my_rank == root)
+    {
+        for (int i = 0; i < total_ranks; i++)
+        {
+            abort_on_corrupt_message(decompress_words(received.data() + message_displacements[i], message_sizes[i],
+                (uint32_t*) receive_data + displacements[i], counts[i]), my_rank, i);
+        }
+    }
+}
+
+// MPI_Scatterv of 32-bit words where root compresses every rank's part on its own (collective)
+inline void compressed_scatterv(const void* send_data, const int* counts, const int* displacements, void* receive_data, int receive_count,
+    int root, MPI_Comm comm, const compression_settings& settings, compression_statistics& statistics)
+{
+    int my_rank;
+    int total_ranks;
+    MPI_Comm_rank(comm, &my_rank);
+    MPI_Comm_size(comm, &total_ranks);
+
+    std::vector<uint8_t> messages;
+    std::vector<int> message_sizes;
+    std::vector<int> message_displacements;
+    if (my_rank == root)
+    {
+        std::vector<uint8_t> message;
+        for (int i = 0; i < total_ranks; i++)
+        {
+            codec_id codec = compress_words((const uint32_t*) send_data + displacements[i], counts[i], settings_for_peer(settings, i), message);
+            count_message(statistics, counts[i] * sizeof(uint32_t), message.size(), codec);
+
+            message_displacements.push_back(messages.size());
+            message_sizes.push_back(message.size());
+            messages.insert(messages.end(), message.begin(), message.end());
+        }
+    }
+
+    int message_size;
+    MPI_Scatter(message_sizes.data(), 1, MPI_INT, &message_size, 1, MPI_INT, root, comm);
+
+    std::vector<uint8_t> received(message_size);
+    MPI_Scatterv(messages.data(), message_sizes.data(), message_displacements.data(), MPI_BYTE, received.data(), message_size, MPI_BYTE, root, comm);
+
+    abort_on_corrupt_message(decompress_words(received.data(), message_size, receive_data, receive_count), my_rank, root);
+}
+
+
+// Ping-pong bandwidth between root and peer in bytes per second, only root and peer take part and only root's value is meaningful
+inline double measure_bandwidth(int root, int peer, MPI_Comm comm)
+{
+    const int message_bytes = 1 << 20;
+    const int repetitions = 8;
+
+    int my_rank;
+    MPI_Comm_rank(comm, &my_rank);
+    std::vector<uint8_t> buffer(message_bytes, 0x5A);
+
+    double start_time = 0.0;
+    // The first round trip only warms up the connection
+    for (int i = 0; i <= repetitions; i++)
+    {
+        if (i == 1)
+        {
+            start_time = MPI_Wtime();
+        }
+        if (my_rank == root)
+        {
+            MPI_Send(buffer.data(), message_bytes, MPI_BYTE, peer, 0, comm);
+            MPI_Recv(buffer.data(), message_bytes, MPI_BYTE, peer, 0, comm, MPI_STATUS_IGNORE);
+        }
+        else
+        {
+            MPI_Recv(buffer.data(), message_bytes, MPI_BYTE, root, 0, comm, MPI_STATUS_IGNORE);
+            MPI_Send(buffer.data(), message_bytes, MPI_BYTE, root, 0, comm);
+        }
+    }
+
+    return 2.0 * message_bytes * repetitions / (MPI_Wtime() - start_time);
+}
+
+// Encode and decode rate (raw bytes per second, best of a few runs) and compression ratio of a codec on a sample
+struct codec_measurement
+{
+    double encode_rate = 0.0;
+    double decode_rate = 0.0;
+    double ratio = 1.0;
+};
+
+inline codec_measurement measure_codec(codec_id codec, const void* sample, int count)
+{
+    const int repetitions = 3;
+
+    compression_settings settings;
+    settings.codec = codec;
+    settings.min_bytes = 0;
+    settings.min_ratio = 0.0;
+
+    std::vector<uint8_t> message;
+    std::vector<uint32_t> decoded(count);
+    double best_encode = 1e30;
+    double best_decode = 1e30;
+    for (int i = 0; i < repetitions; i++)
+    {
+        double start_time = MPI_Wtime();
+        compress_words(sample, count, settings, message);
+        double middle_time = MPI_Wtime();
+        decompress_words(message.data(), message.size(), decoded.data(), count);
+        double end_time = MPI_Wtime();
+
+        best_encode = std::min(best_encode, middle_time - start_time);
+        best_decode = std::min(best_decode, end_time - middle_time);
+    }
+
+    double raw_bytes = (double) count * sizeof(uint32_t);
+    codec_measurement measurement;
+    measurement.encode_rate = raw_bytes / std::max(best_encode, 1e-9);
+    measurement.decode_rate = raw_bytes / std::max(best_decode, 1e-9);
+    measurement.ratio = raw_bytes / message.size();
+    return measurement;
+}
+
+// Codec with the lowest predicted time per raw byte on a link: 1/bandwidth raw, 1/encode + 1/(ratio * bandwidth) + 1/decode compressed
+inline codec_id choose_codec(double bandwidth, const codec_measurement* measurements)
+{
+    codec_id best = CODEC_RAW;
+    double best_time = 1.0 / bandwidth;
+    for (int codec = CODEC_DELTA; codec <= CODEC_LZ; codec++)
+    {
+        const codec_measurement& measurement = measurements[codec];
+        double time = 1.0 / measurement.encode_rate + 1.0 / (measurement.ratio * bandwidth) + 1.0 / measurement.decode_rate;
+        if (time < best_time)
+        {
+            best = (codec_id) codec;
+            best_time = time;
+        }
+    }
+    return best;
+}
+
+// Fill settings.peer_codec for every rank from measurements of its peer class (collective)
+// sample is only used on root and should look like the data that will be sent
+inline void calibrate_compression(const void* sample, int count, int root, MPI_Comm comm, compression_settings& settings, bool report)
+{
+    int my_rank;
+    int total_ranks;
+    MPI_Comm_rank(comm, &my_rank);
+    MPI_Comm_size(comm, &total_ranks);
+
+    // Ranks sharing memory with root form the intra-node class, a node is named by its lowest rank
+    MPI_Comm node_comm;
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, my_rank, MPI_INFO_NULL, &node_comm);
+    int node_leader = my_rank;
+    MPI_Allreduce(MPI_IN_PLACE, &node_leader, 1, MPI_INT, MPI_MIN, node_comm);
+    MPI_Comm_free(&node_comm);
+
+    std::vector<int> node_of_rank(total_ranks);
+    MPI_Allgather(&node_leader, 1, MPI_INT, node_of_rank.data(), 1, MPI_INT, comm);
+
+    // One representative peer per class measures its link to root
+    int intra_peer = -1;
+    int inter_peer = -1;
+    for (int i = 0; i < total_ranks; i++)
+    {
+        if (i == root)
+        {
+            continue;
+        }
+        int& peer = (node_of_rank[i] == node_of_rank[root]) ? intra_peer : inter_peer;
+        if (peer < 0)
+        {
+            peer = i;
+        }
+    }
+
+    double intra_bandwidth = 0.0;
+    double inter_bandwidth = 0.0;
+    if (intra_peer >= 0 && (my_rank == root || my_rank == intra_peer))
+    {
+        intra_bandwidth = measure_bandwidth(root, intra_peer, comm);
+    }
+    if (inter_peer >= 0 && (my_rank == root || my_rank == inter_peer))
+    {
+        inter_bandwidth = measure_bandwidth(root, inter_peer, comm);
+    }
+
+    settings.peer_codec.assign(total_ranks, CODEC_RAW);
+    if (my_rank == root)
+    {
+        codec_measurement measurements[CODEC_LZ + 1];
+        for (int codec = CODEC_DELTA; codec <= CODEC_LZ; codec++)
+        {
+            measurements[codec] = measure_codec((codec_id) codec, sample, count);
+        }
+
+        codec_id intra_codec = (intra_peer >= 0) ? choose_codec(intra_bandwidth, measurements) : CODEC_RAW;
+        codec_id inter_codec = (inter_peer >= 0) ? choose_codec(inter_bandwidth, measurements) : CODEC_RAW;
+        for (int i = 0; i < total_ranks; i++)
+        {
+            // Root's own part never leaves the process
+            if (i != root)
+            {
+                settings.peer_codec[i] = (node_of_rank[i] == node_of_rank[root]) ? intra_codec : inter_codec;
+            }
+        }
+
+        if (report)
+        {
+            printf("\nCALIBRATE %d:    intra-node %.0f MB/s -> %s, inter-node %s%.0f MB/s -> %s", my_rank, intra_bandwidth / 1e6, codec_names[intra_codec],
+                inter_peer >= 0 ? "" : "(no peer) ", inter_bandwidth / 1e6, codec_names[inter_codec]);
+            for (int codec = CODEC_DELTA; codec <= CODEC_LZ; codec++)
+            {
+                printf("\nCALIBRATE %d:    %-5s encode %.0f MB/s, decode %.0f MB/s, ratio %.2f", my_rank, codec_names[codec],
+                    measurements[codec].encode_rate / 1e6, measurements[codec].decode_rate / 1e6, measurements[codec].ratio);
+            }
+            printf("\n");
+        }
+    }
+
+    MPI_Bcast(settings.peer_codec.data(), total_ranks, MPI_UINT8_T, root, comm);
+}
+
+#endif
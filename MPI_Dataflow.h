@@ -0,0 +1,352 @@
+/*Dataflow graph of distributed stages with deferred execution
+-> A dataflow_graph holds every rank's share of one distributed float column and records stages instead of running them:
+    -> map(kernel, layout)      - apply an element-wise kernel (see MPI_Kernel.h)
+    -> filter(predicate)        - keep the elements the predicate accepts
+    -> regroup()                - ask for the balanced layout (the redistribution plan of the pipeline)
+    -> collect()                - ask for the owner layout (every element back on the rank it started on)
+-> Every stage may require a layout: any, balanced or owner. Nothing runs until execute() or reduce() is called, the recorded stages are
+   then planned as a whole:
+    -> a redistribution is only inserted where a stage requires a layout the data is not in, so two balanced maps in a row share one
+    -> two redistributions with no work in between collapse into one, and into none when the data ends up where it started
+    -> consecutive element-wise stages are fused into one pass that runs all of them on small tiles, so the column is read and
+       written once per pass however many maps and filters it holds
+-> Redistributions move the data like the pipeline does: gathered at rank 0 and scattered with MPI_Gatherv/MPI_Scatterv
+-> The owner layout is only known until the first filter, collecting after a filter is reported as a planning error
+*/
+
+#ifndef MPI_DATAFLOW_H
+#define MPI_DATAFLOW_H
+
+#include <mpi.h>
+#include <vector>
+#include <string>
+#include <functional>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include "MPI_Kernel.h"
+
+
+enum dataflow_layout { ANY_LAYOUT, BALANCED_LAYOUT, OWNER_LAYOUT, UNBALANCED_LAYOUT };
+
+const char* const dataflow_layout_names[] = { "any", "balanced", "owner", "unbalanced" };
+
+enum dataflow_reduction { REDUCE_SUM, REDUCE_MIN, REDUCE_MAX, REDUCE_COUNT };
+
+// Target element counts of the balanced layout for the given counts of all ranks
+typedef std::vector<int> (*dataflow_plan_function)(const std::vector<int>&);
+
+// Elements per tile of a fused pass, two tiles of floats stay in the L1 cache
+const size_t dataflow_tile_elements = 1024;
+
+
+struct dataflow_stage
+{
+    std::string name;
+    dataflow_layout required = ANY_LAYOUT;
+    bool changes_count = false;
+    // Runs the stage on count elements of in, writes the results to out and returns how many there are (no operation when empty)
+    std::function<size_t(const float*, float*, size_t)> apply;
+};
+
+// One step of an execution plan: a fused pass over some stages or a redistribution into target
+struct dataflow_step
+{
+    bool redistribute = false;
+    dataflow_layout target = ANY_LAYOUT;
+    dataflow_layout source = ANY_LAYOUT;
+    std::vector<size_t> stages;
+};
+
+
+struct dataflow_graph
+{
+    MPI_Comm comm;
+    dataflow_plan_function plan;
+    std::vector<float> values;
+    dataflow_layout layout = OWNER_LAYOUT;
+    bool owner_known = true;
+    std::vector<int> owner_counts;      // every rank's element count in the owner layout (rank 0 only)
+    std::vector<dataflow_stage> stages;  // recorded, not yet executed
+
+    int passes = 0;
+    int redistributions = 0;
+
+    // Start from every rank's values in the owner layout (collective)
+    dataflow_graph(const std::vector<float>& values, dataflow_plan_function plan, MPI_Comm comm) : comm(comm), plan(plan), values(values)
+    {
+        int my_rank;
+        int total_ranks;
+        MPI_Comm_rank(comm, &my_rank);
+        MPI_Comm_size(comm, &total_ranks);
+
+        int count = values.size();
+        owner_counts.resize(my_rank == 0 ? total_ranks : 0);
+        MPI_Gather(&count, 1, MPI_INT, owner_counts.data(), 1, MPI_INT, 0, comm);
+    }
+
+    template <typename E>
+    dataflow_graph& map(const kernel_expression<E>& expression, dataflow_layout required = ANY_LAYOUT)
+    {
+        E kernel = expression.derived();
+        dataflow_stage stage;
+        stage.name = "map " + kernel.describe();
+        stage.required = required;
+        stage.apply = [kernel](const float* in, float* out, size_t count)
+        {
+            apply_kernel(kernel, in, out, count);
+            return count;
+        };
+        stages.push_back(stage);
+        return *this;
+    }
+
+    template <typename P>
+    dataflow_graph& filter(P predicate, const std::string& description = "predicate", dataflow_layout required = ANY_LAYOUT)
+    {
+        dataflow_stage stage;
+        stage.name = "filter " + description;
+        stage.required = required;
+        stage.changes_count = true;
+        stage.apply = [predicate](const float* in, float* out, size_t count)
+        {
+            size_t kept = 0;
+            for (size_t i = 0; i < count; i++)
+            {
+                out[kept] = in[i];
+                kept += predicate(in[i]) ? 1 : 0;
+            }
+            return kept;
+        };
+        stages.push_back(stage);
+        return *this;
+    }
+
+    dataflow_graph& regroup()
+    {
+        dataflow_stage stage;
+        stage.name = "regroup";
+        stage.required = BALANCED_LAYOUT;
+        stages.push_back(stage);
+        return *this;
+    }
+
+    dataflow_graph& collect()
+    {
+        dataflow_stage stage;
+        stage.name = "collect";
+        stage.required = OWNER_LAYOUT;
+        stages.push_back(stage);
+        return *this;
+    }
+
+    // Plan the recorded stages, returns false with the reason in error when they cannot run
+    bool plan_stages(std::vector<dataflow_step>& steps, std::string& error) const
+    {
+        steps.clear();
+        dataflow_layout current = layout;
+        bool owner = owner_known;
+
+        for (size_t i = 0; i < stages.size(); i++)
+        {
+            const dataflow_stage& stage = stages[i];
+            if (stage.required != ANY_LAYOUT && stage.required != current)
+            {
+                if (stage.required == OWNER_LAYOUT && !owner)
+                {
+                    error = "stage " + std::to_string(i) + " (" + stage.name + ") needs the owner layout, which a filter has dissolved";
+                    return false;
+                }
+
+                if (!steps.empty() && steps.back().redistribute)
+                {
+                    // Nothing ran since the last redistribution, go straight to the new target (or stay where the data was)
+                    steps.back().target = stage.required;
+                    if (steps.back().source == stage.required)
+                    {
+                        steps.pop_back();
+                    }
+                }
+                else
+                {
+                    dataflow_step step;
+                    step.redistribute = true;
+                    step.source = current;
+                    step.target = stage.required;
+                    steps.push_back(step);
+                }
+                current = stage.required;
+            }
+
+            if (stage.apply)
+            {
+                if (steps.empty() || steps.back().redistribute)
+                {
+                    steps.push_back(dataflow_step());
+                }
+                steps.back().stages.push_back(i);
+
+                if (stage.changes_count)
+                {
+                    current = UNBALANCED_LAYOUT;
+                    owner = false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // The plan of the recorded stages as text, e.g. "redistribute(balanced) -> pass[map sin(x)] -> redistribute(owner)"
+    std::string describe() const
+    {
+        std::vector<dataflow_step> steps;
+        std::string error;
+        if (!plan_stages(steps, error))
+        {
+            return "invalid: " + error;
+        }
+
+        std::string text;
+        for (const dataflow_step& step : steps)
+        {
+            text += text.empty() ? "" : " -> ";
+            if (step.redistribute)
+            {
+                text += std::string("redistribute(") + dataflow_layout_names[step.target] + ")";
+                continue;
+            }
+            text += "pass[";
+            for (size_t i = 0; i < step.stages.size(); i++)
+            {
+                text += (i > 0 ? ", " : "") + stages[step.stages[i]].name;
+            }
+            text += "]";
+        }
+        return text.empty() ? "nothing to do" : text;
+    }
+
+    // Gather the column at rank 0 and scatter it again in the target layout (collective)
+    void redistribute(dataflow_layout target)
+    {
+        int my_rank;
+        int total_ranks;
+        MPI_Comm_rank(comm, &my_rank);
+        MPI_Comm_size(comm, &total_ranks);
+
+        int count = values.size();
+        std::vector<int> counts(total_ranks);
+        MPI_Gather(&count, 1, MPI_INT, counts.data(), 1, MPI_INT, 0, comm);
+
+        std::vector<int> displacements(total_ranks, 0);
+        std::vector<int> target_counts(total_ranks);
+        std::vector<int> target_displacements(total_ranks, 0);
+        std::vector<float> combined;
+        if (my_rank == 0)
+        {
+            std::partial_sum(counts.begin(), counts.end() - 1, displacements.begin() + 1);
+            combined.resize(displacements.back() + counts.back());
+            target_counts = (target == BALANCED_LAYOUT) ? plan(counts) : owner_counts;
+            std::partial_sum(target_counts.begin(), target_counts.end() - 1, target_displacements.begin() + 1);
+        }
+        MPI_Gatherv(values.data(), count, MPI_FLOAT, combined.data(), counts.data(), displacements.data(), MPI_FLOAT, 0, comm);
+
+        int target_count;
+        MPI_Scatter(target_counts.data(), 1, MPI_INT, &target_count, 1, MPI_INT, 0, comm);
+        values.resize(target_count);
+        MPI_Scatterv(combined.data(), target_counts.data(), target_displacements.data(), MPI_FLOAT, values.data(), target_count, MPI_FLOAT, 0, comm);
+
+        layout = target;
+        redistributions++;
+    }
+
+    // One pass over the column running the given stages tile by tile, filtered elements are compacted in place
+    void run_pass(const std::vector<size_t>& pass_stages)
+    {
+        float tiles[2][dataflow_tile_elements];
+        size_t count = values.size();
+        size_t kept = 0;
+
+        for (size_t first = 0; first < count; first += dataflow_tile_elements)
+        {
+            size_t length = std::min(dataflow_tile_elements, count - first);
+            const float* in = values.data() + first;
+            int out = 0;
+            for (size_t stage : pass_stages)
+            {
+                length = stages[stage].apply(in, tiles[out], length);
+                in = tiles[out];
+                out = 1 - out;
+            }
+            // The tile was read before the write position, which never passes first, so compacting in place is safe
+            std::copy(in, in + length, values.data() + kept);
+            kept += length;
+        }
+        values.resize(kept);
+
+        for (size_t stage : pass_stages)
+        {
+            if (stages[stage].changes_count)
+            {
+                layout = UNBALANCED_LAYOUT;
+                owner_known = false;
+            }
+        }
+        passes++;
+    }
+
+    // Run all recorded stages (collective), returns false with the reason in error when they cannot be planned
+    bool execute(std::string& error)
+    {
+        std::vector<dataflow_step> steps;
+        if (!plan_stages(steps, error))
+        {
+            return false;
+        }
+        for (const dataflow_step& step : steps)
+        {
+            if (step.redistribute)
+            {
+                redistribute(step.target);
+            }
+            else
+            {
+                run_pass(step.stages);
+            }
+        }
+        stages.clear();
+        return true;
+    }
+
+    // Run the recorded stages and reduce the column over all ranks (collective), the minimum and maximum of no elements are NaN
+    bool reduce(dataflow_reduction reduction, double& result, std::string& error)
+    {
+        if (!execute(error))
+        {
+            return false;
+        }
+
+        double local = (reduction == REDUCE_COUNT) ? values.size() : 0.0;
+        if (reduction == REDUCE_SUM)
+        {
+            local = std::accumulate(values.begin(), values.end(), 0.0);
+        }
+        else if (reduction == REDUCE_MIN)
+        {
+            local = values.empty() ? INFINITY : *std::min_element(values.begin(), values.end());
+        }
+        else if (reduction == REDUCE_MAX)
+        {
+            local = values.empty() ? -INFINITY : *std::max_element(values.begin(), values.end());
+        }
+
+        MPI_Op op = (reduction == REDUCE_MIN) ? MPI_MIN : (reduction == REDUCE_MAX) ? MPI_MAX : MPI_SUM;
+        MPI_Allreduce(&local, &result, 1, MPI_DOUBLE, op, comm);
+        if (std::isinf(result) && (reduction == REDUCE_MIN || reduction == REDUCE_MAX))
+        {
+            result = NAN;
+        }
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,192 @@
+/*Decentralized load balancing by diffusion
+-> No rank ever sees all counts: in every step each rank only exchanges its load (element count) with its neighbors and moves
+   elements directly to the lighter ones
+-> Topologies:
+    -> ring       - neighbors rank - 1 and rank + 1 (wrapping around), each step moves floor((load - neighbor load) / 3) elements
+                    towards the lighter neighbor (diffusion)
+    -> hypercube  - step d pairs rank with rank ^ 2^d (when that rank exists) and the heavier partner hands over half the
+                    difference (dimension exchange), so one sweep over all dimensions balances a power of two ranks completely
+-> After every round (one ring step or one hypercube sweep) two MPI_Allreduce calls of a single number check the imbalance
+   (max load / mean load - 1) and stop once it is within the tolerance or no element moved anymore, a run on changing loads
+   simply continues from the current counts
+-> Elements always leave from the end of the sender and are appended at the end of the receiver, every transfer is logged, so
+   undo_diffusion can replay the log backwards and return values computed for the moved elements to the ranks they came from
+*/
+
+#ifndef MPI_DIFFUSION_H
+#define MPI_DIFFUSION_H
+
+#include <mpi.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include "MPI_DistVector.h"
+
+
+enum diffusion_topology { RING_TOPOLOGY, HYPERCUBE_TOPOLOGY };
+
+const char* const diffusion_topology_names[] = { "ring", "hypercube" };
+
+const int diffusion_tag = 300;
+
+// What one rank sent to and received from one neighbor in one step
+struct diffusion_transfer
+{
+    int neighbor;
+    int sent;
+    int received;
+};
+
+struct diffusion_log
+{
+    std::vector<std::vector<diffusion_transfer>> steps;
+    int rounds = 0;
+    long long moved = 0;          // elements this rank sent
+    double imbalance = 0.0;       // max load / mean load - 1 at the end
+};
+
+
+// Move the transfers' elements: the sent ones leave from the end of values (split in transfer order), the received ones are
+// appended in transfer order; with reverse every transfer is undone instead (collective over the neighbors)
+template <typename T>
+void exchange_transfers(std::vector<T>& values, const std::vector<diffusion_transfer>& transfers, bool reverse, MPI_Comm comm)
+{
+    int outgoing = 0;
+    int incoming = 0;
+    for (const diffusion_transfer& transfer : transfers)
+    {
+        outgoing += reverse ? transfer.received : transfer.sent;
+        incoming += reverse ? transfer.sent : transfer.received;
+    }
+
+    std::vector<T> sent(values.end() - outgoing, values.end());
+    values.resize(values.size() - outgoing + incoming);
+
+    std::vector<MPI_Request> requests;
+    size_t send_position = 0;
+    size_t receive_position = values.size() - incoming;
+    for (const diffusion_transfer& transfer : transfers)
+    {
+        int send_count = reverse ? transfer.received : transfer.sent;
+        int receive_count = reverse ? transfer.sent : transfer.received;
+        if (receive_count > 0)
+        {
+            requests.emplace_back();
+            MPI_Irecv(values.data() + receive_position, receive_count, dist_mpi_type<T>(), transfer.neighbor, diffusion_tag, comm, &requests.back());
+        }
+        if (send_count > 0)
+        {
+            requests.emplace_back();
+            MPI_Isend(sent.data() + send_position, send_count, dist_mpi_type<T>(), transfer.neighbor, diffusion_tag, comm, &requests.back());
+        }
+        send_position += send_count;
+        receive_position += receive_count;
+    }
+    MPI_Waitall(requests.size(), requests.data(), MPI_STATUSES_IGNORE);
+}
+
+// One diffusion step with the given neighbors: swap loads, then move share of every difference to the lighter side
+template <typename T>
+void diffusion_step(std::vector<T>& values, const std::vector<int>& neighbors, double share, diffusion_log& log, MPI_Comm comm)
+{
+    long long load = values.size();
+    std::vector<long long> neighbor_loads(neighbors.size());
+    std::vector<MPI_Request> requests(2 * neighbors.size());
+    for (size_t i = 0; i < neighbors.size(); i++)
+    {
+        MPI_Irecv(&neighbor_loads[i], 1, MPI_LONG_LONG, neighbors[i], diffusion_tag, comm, &requests[2 * i]);
+        MPI_Isend(&load, 1, MPI_LONG_LONG, neighbors[i], diffusion_tag, comm, &requests[2 * i + 1]);
+    }
+    MPI_Waitall(requests.size(), requests.data(), MPI_STATUSES_IGNORE);
+
+    // Both sides of a link compute the same amount from the same two loads
+    std::vector<diffusion_transfer> transfers;
+    for (size_t i = 0; i < neighbors.size(); i++)
+    {
+        long long flow = (long long) (share * std::llabs(load - neighbor_loads[i]));
+        diffusion_transfer transfer = { neighbors[i], load > neighbor_loads[i] ? (int) flow : 0, load < neighbor_loads[i] ? (int) flow : 0 };
+        if (transfer.sent > 0 || transfer.received > 0)
+        {
+            transfers.push_back(transfer);
+            log.moved += transfer.sent;
+        }
+    }
+
+    exchange_transfers(values, transfers, false, comm);
+    log.steps.push_back(transfers);
+}
+
+// Balance values over the ranks by diffusion until max load / mean load - 1 <= tolerance, no element moves anymore or after
+// max_rounds rounds (collective), returns the log needed to undo it
+template <typename T>
+diffusion_log diffuse_load(std::vector<T>& values, diffusion_topology topology, double tolerance, int max_rounds, MPI_Comm comm)
+{
+    int my_rank;
+    int total_ranks;
+    MPI_Comm_rank(comm, &my_rank);
+    MPI_Comm_size(comm, &total_ranks);
+
+    diffusion_log log;
+    long long total_load;
+    long long local_load = values.size();
+    MPI_Allreduce(&local_load, &total_load, 1, MPI_LONG_LONG, MPI_SUM, comm);
+    double mean_load = (double) total_load / total_ranks;
+
+    long long total_moved = 0;
+    while (true)
+    {
+        long long max_load;
+        local_load = values.size();
+        MPI_Allreduce(&local_load, &max_load, 1, MPI_LONG_LONG, MPI_MAX, comm);
+        log.imbalance = (total_load == 0) ? 0.0 : max_load / mean_load - 1.0;
+        if (log.imbalance <= tolerance || log.rounds == max_rounds)
+        {
+            break;
+        }
+
+        if (topology == RING_TOPOLOGY)
+        {
+            std::vector<int> neighbors;
+            if (total_ranks > 1)
+            {
+                neighbors.push_back((my_rank + total_ranks - 1) % total_ranks);
+            }
+            if (total_ranks > 2)
+            {
+                neighbors.push_back((my_rank + 1) % total_ranks);
+            }
+            diffusion_step(values, neighbors, 1.0 / (neighbors.size() + 1), log, comm);
+        }
+        else
+        {
+            for (int dimension = 1; dimension < total_ranks; dimension <<= 1)
+            {
+                int partner = my_rank ^ dimension;
+                diffusion_step(values, partner < total_ranks ? std::vector<int>(1, partner) : std::vector<int>(), 0.5, log, comm);
+            }
+        }
+        log.rounds++;
+
+        // Differences too small for a whole element to flow leave nothing more to do
+        long long moved;
+        MPI_Allreduce(&log.moved, &moved, 1, MPI_LONG_LONG, MPI_SUM, comm);
+        if (moved == total_moved)
+        {
+            break;
+        }
+        total_moved = moved;
+    }
+    return log;
+}
+
+// Return the elements (or values computed for them, one per element) to the ranks they were on before diffuse_load (collective)
+template <typename T>
+void undo_diffusion(std::vector<T>& values, const diffusion_log& log, MPI_Comm comm)
+{
+    for (size_t step = log.steps.size(); step-- > 0;)
+    {
+        exchange_transfers(values, log.steps[step], true, comm);
+    }
+}
+
+#endif
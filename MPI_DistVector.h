@@ -0,0 +1,525 @@
+/*Distributed vector with cached partition metadata
+-> dist_vector<T> holds every rank's local elements of one global sequence (rank 0's elements first, then rank 1's, ...) together with
+   the layout of the whole sequence: every rank's count and global offset, known on every rank
+-> Two layouts are fixed when the vector is built: the original one it was built from and the balanced one given by the plan
+   function (the pipeline's equal split), the exchange plans between them (MPI_Alltoallv counts and displacements) are computed once
+   and shared by every copy and every map() result, so no operation ever rebuilds layout metadata
+-> Operations:
+    -> balance()                  - move the elements into the balanced layout, in place
+    -> restore_original_layout()  - move them back to the ranks they started on
+    -> restore_unordered(arrived) - the same without the ordered MPI_Alltoallv: every chunk is one message carrying the owner's local
+                                    index of its first element, owners take chunks from any source in arrival order
+    -> map<U>(kernel)             - apply an element-wise kernel (see MPI_Kernel.h) locally, the result keeps the layout and plans
+    -> map_balanced<U>(kernel)    - balance() and map() overlapped: the elements a rank keeps in the balanced layout are computed
+                                    while the rest is still in flight, and every received chunk as soon as it has arrived
+    -> gather_to(root)            - the whole sequence on root, in global order
+-> Elements move directly between the ranks whose ranges overlap (one MPI_Alltoallv), nothing is routed through rank 0
+-> Neighborhood kernels (apply_stencil): every rank owns a contiguous range, so a stencil of radius r only needs the r elements on
+   either side of it (the halo), fetched with nonblocking point-to-point messages from whichever ranks hold them while the interior,
+   whose windows lie entirely inside the local range, is already being computed
+-> Prefix scans (inclusive_scan, exclusive_scan): every rank sums its range, MPI_Exscan of the sums gives the total of all ranges
+   before it, and one local scan seeded with that total produces the final values, so the data is read twice and written once
+   (the local sum runs in independent lanes the compiler vectorizes, the seeded scan itself is a scalar loop)
+*/
+
+#ifndef MPI_DIST_VECTOR_H
+#define MPI_DIST_VECTOR_H
+
+#include <mpi.h>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <numeric>
+#include <cstring>
+#include "MPI_Kernel.h"
+
+
+// Tags of the point-to-point messages of map_balanced and restore_unordered
+const int overlap_tag = 201;
+const int unordered_tag = 202;
+
+template <typename T> MPI_Datatype dist_mpi_type();
+template <> inline MPI_Datatype dist_mpi_type<int>() { return MPI_INT; }
+template <> inline MPI_Datatype dist_mpi_type<float>() { return MPI_FLOAT; }
+template <> inline MPI_Datatype dist_mpi_type<double>() { return MPI_DOUBLE; }
+template <> inline MPI_Datatype dist_mpi_type<long long>() { return MPI_LONG_LONG; }
+
+// Every rank's count and global offset in one layout
+struct dist_layout
+{
+    std::vector<int> counts;
+    std::vector<int> offsets;
+
+    explicit dist_layout(const std::vector<int>& counts) : counts(counts), offsets(counts.size(), 0)
+    {
+        std::partial_sum(counts.begin(), counts.end() - 1, offsets.begin() + 1);
+    }
+};
+
+// MPI_Alltoallv arguments moving this rank's elements from one layout into another
+struct dist_exchange
+{
+    std::vector<int> send_counts;
+    std::vector<int> send_displacements;
+    std::vector<int> receive_counts;
+    std::vector<int> receive_displacements;
+    int receive_total = 0;
+};
+
+// Send to every rank the part of this rank's range in from that falls into its range in to, receive the reverse
+inline dist_exchange plan_dist_exchange(const dist_layout& from, const dist_layout& to, int my_rank)
+{
+    int total_ranks = from.counts.size();
+    dist_exchange exchange;
+    exchange.send_counts.assign(total_ranks, 0);
+    exchange.send_displacements.assign(total_ranks, 0);
+    exchange.receive_counts.assign(total_ranks, 0);
+    exchange.receive_displacements.assign(total_ranks, 0);
+
+    long long my_from_first = from.offsets[my_rank];
+    long long my_from_last = my_from_first + from.counts[my_rank];
+    long long my_to_first = to.offsets[my_rank];
+    long long my_to_last = my_to_first + to.counts[my_rank];
+
+    for (int peer = 0; peer < total_ranks; peer++)
+    {
+        long long first = std::max(my_from_first, (long long) to.offsets[peer]);
+        long long last = std::min(my_from_last, (long long) to.offsets[peer] + to.counts[peer]);
+        if (first < last)
+        {
+            exchange.send_counts[peer] = last - first;
+            exchange.send_displacements[peer] = first - my_from_first;
+        }
+
+        first = std::max(my_to_first, (long long) from.offsets[peer]);
+        last = std::min(my_to_last, (long long) from.offsets[peer] + from.counts[peer]);
+        if (first < last)
+        {
+            exchange.receive_counts[peer] = last - first;
+            exchange.receive_displacements[peer] = first - my_to_first;
+        }
+    }
+    exchange.receive_total = to.counts[my_rank];
+    return exchange;
+}
+
+// Layouts and exchange plans of one distributed sequence, shared by all vectors laid out like it
+struct dist_plans
+{
+    dist_layout original;
+    dist_layout balanced;
+    dist_exchange to_balanced;
+    dist_exchange to_original;
+
+    dist_plans(const std::vector<int>& counts, const std::vector<int>& balanced_counts, int my_rank) : original(counts), balanced(balanced_counts),
+        to_balanced(plan_dist_exchange(original, balanced, my_rank)), to_original(plan_dist_exchange(balanced, original, my_rank))
+    {
+    }
+};
+
+// Target element counts of the balanced layout for the given counts of all ranks
+typedef std::vector<int> (*dist_plan_function)(const std::vector<int>&);
+
+
+template <typename T>
+struct dist_vector
+{
+    MPI_Comm comm;
+    int my_rank;
+    std::vector<T> local;
+    std::shared_ptr<const dist_plans> plans;
+    bool balanced = false;
+
+    // Build from every rank's local elements in their original layout and compute both plans once (collective)
+    dist_vector(const std::vector<T>& local, dist_plan_function plan, MPI_Comm comm) : comm(comm), local(local)
+    {
+        int total_ranks;
+        MPI_Comm_rank(comm, &my_rank);
+        MPI_Comm_size(comm, &total_ranks);
+
+        std::vector<int> counts(total_ranks);
+        int count = local.size();
+        MPI_Allgather(&count, 1, MPI_INT, counts.data(), 1, MPI_INT, comm);
+        plans = std::make_shared<const dist_plans>(counts, plan(counts), my_rank);
+    }
+
+    // Same layout and plans as other, with new local elements (one per local element of other)
+    template <typename U>
+    dist_vector(const dist_vector<U>& other, std::vector<T> local) : comm(other.comm), my_rank(other.my_rank), local(std::move(local)),
+        plans(other.plans), balanced(other.balanced)
+    {
+    }
+
+    const dist_layout& layout() const
+    {
+        return balanced ? plans->balanced : plans->original;
+    }
+
+    long long size() const
+    {
+        return (long long) plans->original.offsets.back() + plans->original.counts.back();
+    }
+
+    // Global position of the first local element
+    long long global_offset() const
+    {
+        return layout().offsets[my_rank];
+    }
+
+    void exchange(const dist_exchange& exchange)
+    {
+        std::vector<T> received(exchange.receive_total);
+        MPI_Alltoallv(local.data(), exchange.send_counts.data(), exchange.send_displacements.data(), dist_mpi_type<T>(), received.data(),
+            exchange.receive_counts.data(), exchange.receive_displacements.data(), dist_mpi_type<T>(), comm);
+        local.swap(received);
+    }
+
+    // Move the elements into the balanced layout (collective), does nothing when they already are
+    void balance()
+    {
+        if (!balanced)
+        {
+            exchange(plans->to_balanced);
+            balanced = true;
+        }
+    }
+
+    // Move the elements back to the ranks they were built on (collective), does nothing when they already are
+    void restore_original_layout()
+    {
+        if (balanced)
+        {
+            exchange(plans->to_original);
+            balanced = false;
+        }
+    }
+
+    // restore_original_layout() in arrival order: each chunk is sent as one message [owner's local index of the first element | elements],
+    // owners receive from any source until all their elements are back and call arrived(first, count) once each chunk is in place
+    // (collective, every rank must have finished the previous call before another one starts, the pipeline's iteration barrier ensures it)
+    template <typename F>
+    void restore_unordered(F arrived)
+    {
+        if (!balanced)
+        {
+            return;
+        }
+
+        const dist_exchange& exchange = plans->to_original;
+        const dist_layout& original = plans->original;
+        int total_ranks = exchange.send_counts.size();
+        long long first = plans->balanced.offsets[my_rank];
+        std::vector<T> owned(original.counts[my_rank]);
+
+        std::vector<std::vector<char>> messages;
+        std::vector<MPI_Request> sends;
+        messages.reserve(total_ranks);
+        for (int peer = 0; peer < total_ranks; peer++)
+        {
+            int count = exchange.send_counts[peer];
+            if (count == 0 || peer == my_rank)
+            {
+                continue;
+            }
+            int index = first + exchange.send_displacements[peer] - original.offsets[peer];
+            messages.emplace_back(sizeof(int) + count * sizeof(T));
+            memcpy(messages.back().data(), &index, sizeof(int));
+            memcpy(messages.back().data() + sizeof(int), local.data() + exchange.send_displacements[peer], count * sizeof(T));
+            sends.emplace_back();
+            MPI_Isend(messages.back().data(), messages.back().size(), MPI_BYTE, peer, unordered_tag, comm, &sends.back());
+        }
+
+        // The chunk this rank keeps arrives first
+        long long received = exchange.send_counts[my_rank];
+        if (received > 0)
+        {
+            std::copy(local.begin() + exchange.send_displacements[my_rank], local.begin() + exchange.send_displacements[my_rank] + received,
+                owned.begin() + exchange.receive_displacements[my_rank]);
+            arrived(exchange.receive_displacements[my_rank], (int) received);
+        }
+
+        std::vector<char> message;
+        while (received < (long long) owned.size())
+        {
+            MPI_Status status;
+            int bytes;
+            MPI_Probe(MPI_ANY_SOURCE, unordered_tag, comm, &status);
+            MPI_Get_count(&status, MPI_BYTE, &bytes);
+            message.resize(bytes);
+            MPI_Recv(message.data(), bytes, MPI_BYTE, status.MPI_SOURCE, unordered_tag, comm, MPI_STATUS_IGNORE);
+
+            int index;
+            int count = (bytes - sizeof(int)) / sizeof(T);
+            memcpy(&index, message.data(), sizeof(int));
+            memcpy(owned.data() + index, message.data() + sizeof(int), count * sizeof(T));
+            received += count;
+            arrived(index, count);
+        }
+        MPI_Waitall(sends.size(), sends.data(), MPI_STATUSES_IGNORE);
+
+        local.swap(owned);
+        balanced = false;
+    }
+
+    // kernel applied to every local element, in the same layout
+    template <typename U, typename E>
+    dist_vector<U> map(const kernel_expression<E>& kernel) const
+    {
+        std::vector<U> results(local.size());
+        apply_kernel(kernel, local.data(), results.data(), local.size());
+        return dist_vector<U>(*this, std::move(results));
+    }
+
+    // Elements this rank holds in both the original and the balanced layout
+    int retained_elements() const
+    {
+        return plans->to_balanced.send_counts[my_rank];
+    }
+
+    // The same as balance() followed by map(), but the exchange is posted with nonblocking messages first, the retained elements are
+    // computed while it runs and each peer's chunk as soon as it has arrived; the vector itself keeps its layout (collective)
+    template <typename U, typename E>
+    dist_vector<U> map_balanced(const kernel_expression<E>& kernel) const
+    {
+        if (balanced)
+        {
+            return map<U>(kernel);
+        }
+
+        const dist_exchange& exchange = plans->to_balanced;
+        int total_ranks = exchange.send_counts.size();
+        std::vector<T> received(exchange.receive_total);
+        std::vector<U> results(exchange.receive_total);
+
+        std::vector<MPI_Request> receives;
+        std::vector<int> sources;
+        std::vector<MPI_Request> sends;
+        for (int peer = 0; peer < total_ranks; peer++)
+        {
+            if (peer == my_rank)
+            {
+                continue;
+            }
+            if (exchange.receive_counts[peer] > 0)
+            {
+                receives.emplace_back();
+                sources.push_back(peer);
+                MPI_Irecv(received.data() + exchange.receive_displacements[peer], exchange.receive_counts[peer], dist_mpi_type<T>(), peer,
+                    overlap_tag, comm, &receives.back());
+            }
+            if (exchange.send_counts[peer] > 0)
+            {
+                sends.emplace_back();
+                MPI_Isend(local.data() + exchange.send_displacements[peer], exchange.send_counts[peer], dist_mpi_type<T>(), peer, overlap_tag,
+                    comm, &sends.back());
+            }
+        }
+
+        // The retained range needs no message, it is read straight from the local elements
+        apply_kernel(kernel, local.data() + exchange.send_displacements[my_rank], results.data() + exchange.receive_displacements[my_rank],
+            exchange.send_counts[my_rank]);
+
+        for (size_t done = 0; done < receives.size(); done++)
+        {
+            int index;
+            MPI_Waitany(receives.size(), receives.data(), &index, MPI_STATUS_IGNORE);
+            int peer = sources[index];
+            apply_kernel(kernel, received.data() + exchange.receive_displacements[peer], results.data() + exchange.receive_displacements[peer],
+                exchange.receive_counts[peer]);
+        }
+        MPI_Waitall(sends.size(), sends.data(), MPI_STATUSES_IGNORE);
+
+        dist_vector<U> mapped(*this, std::move(results));
+        mapped.balanced = true;
+        return mapped;
+    }
+
+    // The whole sequence in global order on root, empty on the other ranks (collective)
+    std::vector<T> gather_to(int root) const
+    {
+        std::vector<T> all(my_rank == root ? size() : 0);
+        const dist_layout& current = layout();
+        MPI_Gatherv(local.data(), local.size(), dist_mpi_type<T>(), all.data(), current.counts.data(), current.offsets.data(), dist_mpi_type<T>(),
+            root, comm);
+        return all;
+    }
+};
+
+
+
+const int halo_tag = 200;
+
+// Receive the halo of this rank's range and send this rank's elements to the halos of the others, all nonblocking
+// halo holds [left halo | local elements | right halo] afterwards, left and right are the halo lengths (shorter at the sequence ends)
+template <typename T>
+void start_halo_exchange(const dist_vector<T>& input, int radius, std::vector<T>& halo, int& left, int& right, std::vector<MPI_Request>& requests)
+{
+    const dist_layout& layout = input.layout();
+    int total_ranks = layout.counts.size();
+    long long total = input.size();
+    long long first = layout.offsets[input.my_rank];
+    long long last = first + layout.counts[input.my_rank];
+
+    left = (first == last) ? 0 : std::min<long long>(radius, first);
+    right = (first == last) ? 0 : std::min<long long>(radius, total - last);
+    halo.resize(left + (last - first) + right);
+    requests.clear();
+
+    for (int peer = 0; peer < total_ranks; peer++)
+    {
+        long long peer_first = layout.offsets[peer];
+        long long peer_last = peer_first + layout.counts[peer];
+        if (peer == input.my_rank || peer_first == peer_last)
+        {
+            continue;
+        }
+
+        // Part of my halo [first - left, last + right) the peer holds (it lies on one side of my range only)
+        long long begin = std::max(first - left, peer_first);
+        long long end = std::min(last + right, peer_last);
+        if (first != last && begin < end)
+        {
+            requests.emplace_back();
+            MPI_Irecv(halo.data() + (begin - (first - left)), end - begin, dist_mpi_type<T>(), peer, halo_tag, input.comm, &requests.back());
+        }
+
+        // Part of the peer's halo I hold
+        begin = std::max(peer_first - std::min<long long>(radius, peer_first), first);
+        end = std::min(peer_last + std::min<long long>(radius, total - peer_last), last);
+        if (begin < end)
+        {
+            requests.emplace_back();
+            MPI_Isend(input.local.data() + (begin - first), end - begin, dist_mpi_type<T>(), peer, halo_tag, input.comm, &requests.back());
+        }
+    }
+}
+
+// results[i] = stencil(center, before, after) for every local element, where center points at the element inside its window and
+// before and after are how many neighbors the window holds on each side (radius, fewer at the ends of the sequence) (collective)
+template <typename U, typename T, typename S>
+dist_vector<U> apply_stencil(const dist_vector<T>& input, int radius, S stencil)
+{
+    int count = input.local.size();
+    std::vector<U> results(count);
+
+    std::vector<T> halo;
+    int left;
+    int right;
+    std::vector<MPI_Request> requests;
+    start_halo_exchange(input, radius, halo, left, right, requests);
+
+    // Interior: the whole window is local
+    const T* local = input.local.data();
+    for (int i = radius; i < count - radius; i++)
+    {
+        results[i] = stencil(local + i, radius, radius);
+    }
+
+    std::copy(input.local.begin(), input.local.end(), halo.begin() + left);
+    MPI_Waitall(requests.size(), requests.data(), MPI_STATUSES_IGNORE);
+
+    // Boundary: the windows reach into the halo
+    for (int i = 0; i < count; i++)
+    {
+        if (i == radius && count - radius > radius)
+        {
+            i = count - radius;
+        }
+        results[i] = stencil(halo.data() + left + i, std::min(radius, left + i), std::min(radius, right + count - 1 - i));
+    }
+    return dist_vector<U>(input, std::move(results));
+}
+
+// Mean of the window
+struct moving_average_stencil
+{
+    template <typename T>
+    double operator()(const T* center, int before, int after) const
+    {
+        double sum = 0.0;
+        for (int i = -before; i <= after; i++)
+        {
+            sum += center[i];
+        }
+        return sum / (before + after + 1);
+    }
+};
+
+// Central difference (x[i + 1] - x[i - 1]) / 2, one-sided at the ends of the sequence
+struct central_difference_stencil
+{
+    template <typename T>
+    double operator()(const T* center, int before, int after) const
+    {
+        int next = std::min(after, 1);
+        int previous = std::min(before, 1);
+        return (next + previous == 0) ? 0.0 : ((double) center[next] - center[-previous]) / (next + previous);
+    }
+};
+
+// Partial sums per lane of the local sum: each lane is its own chain of additions, so the loop needs no reassociation and the
+// compiler vectorizes it without -ffast-math (the total differs from a serial sum only by rounding)
+const size_t scan_lanes = 8;
+
+template <typename U, typename T>
+U lane_sum(const T* values, size_t count)
+{
+    U lanes[scan_lanes] = {};
+    size_t blocked = count - count % scan_lanes;
+    for (size_t i = 0; i < blocked; i += scan_lanes)
+    {
+        for (size_t lane = 0; lane < scan_lanes; lane++)
+        {
+            lanes[lane] += (U) values[i + lane];
+        }
+    }
+
+    U total = U();
+    for (size_t lane = 0; lane < scan_lanes; lane++)
+    {
+        total += lanes[lane];
+    }
+    for (size_t i = blocked; i < count; i++)
+    {
+        total += (U) values[i];
+    }
+    return total;
+}
+
+// Prefix sums of the sequence in the same layout, accumulated in U (use double for long float sequences) (collective)
+// inclusive: results[i] = input[0] + ... + input[i], otherwise input[0] + ... + input[i - 1]
+template <typename U, typename T>
+dist_vector<U> prefix_scan(const dist_vector<T>& input, bool inclusive)
+{
+    // Reduce first with the vectorized lane sum, only the final pass below is a scalar running sum
+    U local_total = lane_sum<U>(input.local.data(), input.local.size());
+    U running = U();
+    MPI_Exscan(&local_total, &running, 1, dist_mpi_type<U>(), MPI_SUM, input.comm);
+    if (input.my_rank == 0)
+    {
+        running = U();
+    }
+
+    std::vector<U> results(input.local.size());
+    for (size_t i = 0; i < input.local.size(); i++)
+    {
+        U next = running + (U) input.local[i];
+        results[i] = inclusive ? next : running;
+        running = next;
+    }
+    return dist_vector<U>(input, std::move(results));
+}
+
+template <typename U, typename T>
+dist_vector<U> inclusive_scan(const dist_vector<T>& input)
+{
+    return prefix_scan<U>(input, true);
+}
+
+template <typename U, typename T>
+dist_vector<U> exclusive_scan(const dist_vector<T>& input)
+{
+    return prefix_scan<U>(input, false);
+}
+
+#endif
@@ -33,8 +33,1911 @@ int main(int argc, char** argv)
 #include <vector>
 #include <numeric>
 #include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <cstdint>
+#include <random>
+#include <algorithm>
+#include <memory>
+#include "MPI_Compression.h"
+#include "MPI_ResultFile.h"
+#include "MPI_TextIO.h"
+#include "MPI_Checkpoint.h"
+#include "MPI_ResultCache.h"
+#include "MPI_Kernel.h"
+#include "MPI_Dataflow.h"
+#include "MPI_DistVector.h"
+#include "MPI_Selection.h"
+#include "MPI_Diffusion.h"
+#include "MPI_WorkStealing.h"
+#include "MPI_OneSided.h"
+#include "MPI_ResultStream.h"
 using namespace std;
 
+
+// Command line options (all optional, the defaults reproduce the original small demo run)
+//   --elements N        upper bound for the number of elements created on each rank (default 10)
+//   --distribution D    how element counts are spread over the ranks:
+//                         uniform -> every rank creates rand() % N elements
+//                         skewed  -> rank r creates rand() % (N / (r + 1) + 1) elements (few heavy ranks, long tail)
+//                         single  -> rank 0 holds all N elements, every other rank holds none
+//   --iterations K      run the redistribution pipeline K times and report the slowest rank's time per run
+//   --quiet             do not print the individual elements (needed for benchmark sized runs)
+//   --verify [TOL]      recompute sin(theta) locally on every rank and compare it with the returned results,
+//                       an element mismatches when it differs by more than TOL (default 1e-6)
+//   --checksum          hash the data every rank sends and receives in each redistribution phase and check
+//                       that nothing was lost, duplicated or reordered
+//   --stress-plan [C]   instead of the normal run, check the redistribution plan on C random count vectors
+//                       (default 10000) and move real data through the MPI pipeline for a share of them
+//   --seed S            random seed of --stress-plan (default: time based, printed so failures can be repeated)
+//   --record FILE       write every rank's seed, element count and the redistribution plan to a binary run log
+//   --replay FILE       recreate the exact inputs of a recorded run (same number of ranks) and run the pipeline on them
+//   --compress CODEC    compress every MPI_Gatherv/MPI_Scatterv message with delta, rle or lz (see MPI_Compression.h),
+//                       auto measures link bandwidth and codec speed at startup and compresses only where it pays off
+//   --compress-min-bytes N   messages smaller than N bytes are sent raw (default 4096)
+//   --compress-min-ratio R   messages the codec shrinks by less than R are sent raw (default 1.1)
+//   --write-results FILE     write the final results of all ranks to a binary result file (see MPI_ResultFile.h)
+//   --result-checksums       store a checksum per rank block in the result file
+//   --read-results FILE      instead of the normal run, check a result file on rank 0 and print its index
+//   --inspect-range F,C      print the C results from global element F on of the --read-results file, or with --write-results and
+//                            --verify read them back from the written file and compare them with the results
+//   --input FILE        read the elements from a text file of angles instead of creating random ones, every rank
+//                       parses its own byte range of the file (see MPI_TextIO.h)
+//   --text-output FILE  write the final results as text, one per line, to FILE in rank order (see MPI_TextIO.h)
+//   --text-output-per-rank   write FILE.<rank> per rank instead of one shared file
+//   --io-ranks-per-node N    reserve the last N ranks of every node as I/O servers: they read --input for their compute
+//                            ranks and write --text-output for them, the pipeline runs on the remaining compute ranks
+//   --batch-elements B  streaming run: push the elements through the pipeline B per rank at a time instead of all at once
+//   --checkpoint FILE   checkpoint the streaming run to FILE.<rank> in the background (see MPI_Checkpoint.h)
+//   --checkpoint-every K     checkpoint after every K batches (default 1) and after the last one
+//   --restart           resume a streaming run from the last batch all ranks have checkpointed in --checkpoint FILE
+//   --cache DIR         serve blocks of elements computed by earlier runs from the result cache in DIR and store the new ones,
+//                       only uncached elements go through the pipeline (see MPI_ResultCache.h)
+//   --cache-block-elements N  elements per cached block (default 65536)
+//   --dataflow          run the pipeline as a deferred dataflow graph (see MPI_Dataflow.h) and reduce the results with a second one
+//   --dist-vector       keep the elements in a dist_vector (see MPI_DistVector.h) whose layouts and exchange plans are computed
+//                       once and reused by every iteration, elements move directly between ranks instead of through rank 0
+//   --overlap           with --dist-vector, compute the elements a rank keeps while the exchange of the others is in flight and
+//                       every received chunk as soon as it arrives
+//   --unordered-return  with --dist-vector, send the results back as chunks tagged with the owner's index and accept them from any
+//                       rank in arrival order instead of with the ordered exchange
+//   --rma               every rank exposes its elements and results in MPI windows, pulls its balanced range with MPI_Get and puts
+//                       the results straight back into the owners' arrays with MPI_Put (see MPI_OneSided.h)
+//   --result-chunk-elements N   return the pipeline's results in chunks of N and consume every chunk on its owner as soon as it
+//                               has arrived instead of after the whole MPI_Scatterv (see MPI_ResultStream.h)
+//   --stencil-radius R  smooth the balanced results with a moving average of radius R, fetching the neighbors' boundary elements
+//                       with a halo exchange (see MPI_DistVector.h), --verify checks it against a sequential average on rank 0
+//   --scan              cumulative sums of the balanced results with a distributed prefix scan (see MPI_DistVector.h),
+//                       --verify checks the inclusive and exclusive scans against sequential sums on rank 0
+//   --quantiles P,...   quantiles of the results, e.g. 0.5,0.99, found without gathering them (see MPI_Selection.h)
+//   --top-k K           the K largest results, only those are gathered at rank 0
+//   --diffusion T       balance without rank 0: ranks move elements to lighter neighbors in a ring or hypercube (T) until the
+//                       imbalance (max / mean - 1) is within --diffusion-tolerance (default 0.01), see MPI_Diffusion.h
+//   --threads N         compute the task of the pipeline on N threads per rank with a work-stealing scheduler (see MPI_WorkStealing.h)
+//   --grain G           largest range of elements one scheduled task computes (default 1024)
+struct run_options
+{
+    int max_elements = 10;
+    string distribution = "uniform";
+    int iterations = 1;
+    bool quiet = false;
+    bool verify = false;
+    double verify_tolerance = 1e-6;
+    bool checksum = false;
+    int stress_cases = 0;
+    unsigned int stress_seed = 0;
+    string record_file;
+    string replay_file;
+    compression_settings compression;
+    string write_results_file;
+    bool result_checksums = false;
+    string read_results_file;
+    long long inspect_first = 0;
+    long long inspect_count = 0;
+    string input_file;
+    string text_output_file;
+    bool text_output_per_rank = false;
+    int io_ranks_per_node = 0;
+    int batch_elements = 0;
+    string checkpoint_file;
+    int checkpoint_every = 1;
+    bool restart = false;
+    string cache_dir;
+    int cache_block_elements = 65536;
+    bool dataflow = false;
+    bool dist_vector = false;
+    bool overlap = false;
+    bool unordered_return = false;
+    bool rma = false;
+    int result_chunk_elements = 0;
+    int stencil_radius = 0;
+    bool scan = false;
+    vector<double> quantiles;
+    long long top_k = 0;
+    string diffusion;
+    double diffusion_tolerance = 0.01;
+    int threads = 1;
+    int grain = 1024;
+};
+
+
+// Parse argv into options, returns false (after printing the reason on rank 0) for unknown or malformed options
+bool parse_options(int argc, char** argv, int my_rank, run_options& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        bool has_value = i + 1 < argc;
+
+        if (strcmp(argv[i], "--elements") == 0 && has_value)
+        {
+            options.max_elements = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--distribution") == 0 && has_value)
+        {
+            options.distribution = argv[++i];
+        }
+        else if (strcmp(argv[i], "--iterations") == 0 && has_value)
+        {
+            options.iterations = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--quiet") == 0)
+        {
+            options.quiet = true;
+        }
+        else if (strcmp(argv[i], "--checksum") == 0)
+        {
+            options.checksum = true;
+        }
+        else if (strcmp(argv[i], "--stress-plan") == 0)
+        {
+            options.stress_cases = 10000;
+            if (has_value && argv[i + 1][0] != '-')
+            {
+                options.stress_cases = atoi(argv[++i]);
+            }
+        }
+        else if (strcmp(argv[i], "--seed") == 0 && has_value)
+        {
+            options.stress_seed = strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--record") == 0 && has_value)
+        {
+            options.record_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "--replay") == 0 && has_value)
+        {
+            options.replay_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "--compress") == 0 && has_value)
+        {
+            const char* name = argv[++i];
+            options.compression.adaptive = strcmp(name, "auto") == 0;
+            options.compression.codec = (codec_id) (find_if(begin(codec_names), end(codec_names),
+                [name](const char* codec_name) { return strcmp(codec_name, name) == 0; }) - begin(codec_names));
+        }
+        else if (strcmp(argv[i], "--compress-min-bytes") == 0 && has_value)
+        {
+            options.compression.min_bytes = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--compress-min-ratio") == 0 && has_value)
+        {
+            options.compression.min_ratio = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--write-results") == 0 && has_value)
+        {
+            options.write_results_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "--result-checksums") == 0)
+        {
+            options.result_checksums = true;
+        }
+        else if (strcmp(argv[i], "--inspect-range") == 0 && has_value)
+        {
+            // Malformed ranges end up with a negative count and are rejected below
+            if (sscanf(argv[++i], "%lld,%lld", &options.inspect_first, &options.inspect_count) != 2)
+            {
+                options.inspect_count = -1;
+            }
+        }
+        else if (strcmp(argv[i], "--read-results") == 0 && has_value)
+        {
+            options.read_results_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "--input") == 0 && has_value)
+        {
+            options.input_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "--text-output") == 0 && has_value)
+        {
+            options.text_output_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "--text-output-per-rank") == 0)
+        {
+            options.text_output_per_rank = true;
+        }
+        else if (strcmp(argv[i], "--io-ranks-per-node") == 0 && has_value)
+        {
+            options.io_ranks_per_node = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--batch-elements") == 0 && has_value)
+        {
+            options.batch_elements = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--checkpoint") == 0 && has_value)
+        {
+            options.checkpoint_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "--checkpoint-every") == 0 && has_value)
+        {
+            options.checkpoint_every = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--restart") == 0)
+        {
+            options.restart = true;
+        }
+        else if (strcmp(argv[i], "--cache") == 0 && has_value)
+        {
+            options.cache_dir = argv[++i];
+        }
+        else if (strcmp(argv[i], "--cache-block-elements") == 0 && has_value)
+        {
+            options.cache_block_elements = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--dataflow") == 0)
+        {
+            options.dataflow = true;
+        }
+        else if (strcmp(argv[i], "--dist-vector") == 0)
+        {
+            options.dist_vector = true;
+        }
+        else if (strcmp(argv[i], "--overlap") == 0)
+        {
+            options.overlap = true;
+        }
+        else if (strcmp(argv[i], "--unordered-return") == 0)
+        {
+            options.unordered_return = true;
+        }
+        else if (strcmp(argv[i], "--rma") == 0)
+        {
+            options.rma = true;
+        }
+        else if (strcmp(argv[i], "--result-chunk-elements") == 0 && has_value)
+        {
+            options.result_chunk_elements = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--stencil-radius") == 0 && has_value)
+        {
+            options.stencil_radius = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--scan") == 0)
+        {
+            options.scan = true;
+        }
+        else if (strcmp(argv[i], "--quantiles") == 0 && has_value)
+        {
+            // Comma separated probabilities, anything outside [0, 1] is rejected below
+            char* position = argv[++i];
+            do
+            {
+                char* end;
+                double probability = strtod(position, &end);
+                options.quantiles.push_back((end == position || probability < 0.0 || probability > 1.0) ? -1.0 : probability);
+                position = (*end == ',') ? end + 1 : end;
+                if (*end != ',' && *end != '\0')
+                {
+                    options.quantiles.push_back(-1.0);
+                    break;
+                }
+            } while (*position != '\0');
+        }
+        else if (strcmp(argv[i], "--top-k") == 0 && has_value)
+        {
+            options.top_k = atoll(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--diffusion") == 0 && has_value)
+        {
+            options.diffusion = argv[++i];
+        }
+        else if (strcmp(argv[i], "--diffusion-tolerance") == 0 && has_value)
+        {
+            options.diffusion_tolerance = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && has_value)
+        {
+            options.threads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--grain") == 0 && has_value)
+        {
+            options.grain = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--verify") == 0)
+        {
+            options.verify = true;
+            // The tolerance is optional, only consume the next argument when it is a number
+            if (has_value && argv[i + 1][0] != '-')
+            {
+                options.verify_tolerance = atof(argv[++i]);
+            }
+        }
+        else
+        {
+            if (my_rank == 0)
+            {
+                fprintf(stderr, "Unknown or incomplete option: %s\n", argv[i]);
+            }
+            return false;
+        }
+    }
+
+    if (options.max_elements < 1 || options.iterations < 1 || options.verify_tolerance < 0.0 || options.stress_cases < 0 || options.io_ranks_per_node < 0 ||
+        options.batch_elements < 0 || options.checkpoint_every < 1 || options.cache_block_elements < 1 || options.stencil_radius < 0 || options.top_k < 0 || options.diffusion_tolerance < 0.0 || options.threads < 1 || options.grain < 1 || options.result_chunk_elements < 0 || options.inspect_first < 0 || options.inspect_count < 0 ||
+        (!options.diffusion.empty() && options.diffusion != "ring" && options.diffusion != "hypercube") ||
+        count(options.quantiles.begin(), options.quantiles.end(), -1.0) > 0 ||
+        (options.compression.codec > CODEC_LZ && !options.compression.adaptive) || options.compression.min_bytes < 0 || options.compression.min_ratio <= 0.0 ||
+        (options.distribution != "uniform" && options.distribution != "skewed" && options.distribution != "single"))
+    {
+        if (my_rank == 0)
+        {
+            fprintf(stderr, "Invalid option value: --elements and --iterations must be positive, --verify tolerance must not be negative, "
+                "--distribution is uniform, skewed or single, --compress is raw, delta, rle, lz or auto, --diffusion is ring or hypercube\n");
+        }
+        return false;
+    }
+
+    if (!options.input_file.empty() && (!options.record_file.empty() || !options.replay_file.empty()))
+    {
+        if (my_rank == 0)
+        {
+            fprintf(stderr, "--record and --replay reproduce generated inputs and cannot be combined with --input\n");
+        }
+        return false;
+    }
+
+    if (options.io_ranks_per_node > 0 && options.text_output_per_rank)
+    {
+        if (my_rank == 0)
+        {
+            fprintf(stderr, "I/O ranks write one shared text file, --text-output-per-rank cannot be combined with --io-ranks-per-node\n");
+        }
+        return false;
+    }
+
+    if ((!options.checkpoint_file.empty() && (options.batch_elements == 0 || options.iterations > 1)) ||
+        (options.restart && (options.checkpoint_file.empty() || !options.replay_file.empty())))
+    {
+        if (my_rank == 0)
+        {
+            fprintf(stderr, "--checkpoint needs a streaming run (--batch-elements) of one iteration, --restart needs --checkpoint and "
+                "cannot be combined with --replay\n");
+        }
+        return false;
+    }
+
+    int redistribution_modes = options.dataflow + options.dist_vector + !options.diffusion.empty() + options.rma;
+    if (redistribution_modes > 0 &&
+        (redistribution_modes > 1 || options.batch_elements > 0 || options.checksum || options.compression.codec != CODEC_RAW || options.compression.adaptive))
+    {
+        if (my_rank == 0)
+        {
+            fprintf(stderr, "--dataflow, --dist-vector, --diffusion and --rma run their own redistributions, they cannot be combined with each other, "
+                "--batch-elements, --checksum or --compress\n");
+        }
+        return false;
+    }
+
+    if (options.inspect_count > 0 && options.read_results_file.empty() && (options.write_results_file.empty() || !options.verify))
+    {
+        if (my_rank == 0)
+        {
+            fprintf(stderr, "--inspect-range reads a result file and needs --read-results, or --write-results with --verify\n");
+        }
+        return false;
+    }
+
+    if (options.result_chunk_elements > 0 && (redistribution_modes > 0 || options.compression.codec != CODEC_RAW || options.compression.adaptive))
+    {
+        if (my_rank == 0)
+        {
+            fprintf(stderr, "--result-chunk-elements streams the uncompressed result return of the pipeline and cannot be combined with "
+                "--compress or the other redistributions\n");
+        }
+        return false;
+    }
+
+    if ((options.overlap || options.unordered_return) && !options.dist_vector)
+    {
+        if (my_rank == 0)
+        {
+            fprintf(stderr, "--overlap and --unordered-return change how the dist_vector exchanges run and need --dist-vector\n");
+        }
+        return false;
+    }
+
+    if (!options.cache_dir.empty() && !options.checkpoint_file.empty())
+    {
+        if (my_rank == 0)
+        {
+            fprintf(stderr, "Checkpoints record the elements of the whole stream, --cache cannot be combined with --checkpoint\n");
+        }
+        return false;
+    }
+
+    return true;
+}
+
+
+// Create random number of elements in the calling process with random values in range 0-180 (theta)
+// The seed is my_rank + time(NULL) for a normal run and the recorded seed when a run is replayed
+vector<int> generate_elements(int my_rank, unsigned int seed, const run_options& options)
+{
+    srand(seed);
+
+    int num_elements;
+    if (options.distribution == "single")
+    {
+        num_elements = (my_rank == 0) ? options.max_elements : 0;
+    }
+    else if (options.distribution == "skewed")
+    {
+        num_elements = rand() % (options.max_elements / (my_rank + 1) + 1);
+    }
+    else
+    {
+        num_elements = rand() % options.max_elements;
+    }
+
+    vector<int> original_array;
+    original_array.reserve(num_elements);
+    int theta;
+    for (int i = 0; i < num_elements; i++)
+    {
+        theta = rand() % 181;
+        original_array.push_back(theta);
+    }
+
+    return original_array;
+}
+
+
+// Check the returned results against a local std::sin reference of the elements this rank owns
+// Every rank lists its own mismatched indices, the global maximum error and mismatch count are combined with one MPI_Allreduce
+void combine_verification(void* in, void* inout, int* len, MPI_Datatype* /* datatype */)
+{
+    // Pairs of {max_error, mismatches}: maximum of the first, sum of the second
+    double* in_values = (double*) in;
+    double* inout_values = (double*) inout;
+    for (int i = 0; i + 1 < *len; i += 2)
+    {
+        inout_values[i] = max(inout_values[i], in_values[i]);
+        inout_values[i + 1] += in_values[i + 1];
+    }
+}
+
+bool verify_results(const vector<int>& original_array, const vector<float>& final_results_array, int my_rank, const run_options& options,
+    MPI_Comm comm)
+{
+    const int max_reported_indices = 10;
+
+    double max_error = 0.0;
+    long long mismatches = 0;
+    vector<int> mismatched_indices;
+
+    if (final_results_array.size() != original_array.size())
+    {
+        // Every element without a result (or every surplus result) counts as a mismatch
+        mismatches = llabs((long long) final_results_array.size() - (long long) original_array.size());
+        max_error = INFINITY;
+    }
+
+    for (size_t i = 0; i < min(original_array.size(), final_results_array.size()); i++)
+    {
+        float reference = std::sin(original_array[i] * atan(1) / 45.0);
+        double error = fabs((double) final_results_array[i] - reference);
+
+        // NaN never compares greater than the tolerance, so check for it explicitly
+        if (error > options.verify_tolerance || std::isnan(error))
+        {
+            mismatches++;
+            if (mismatched_indices.size() < max_reported_indices)
+            {
+                mismatched_indices.push_back((int) i);
+            }
+        }
+        if (error > max_error || std::isnan(error))
+        {
+            max_error = std::isnan(error) ? INFINITY : error;
+        }
+    }
+
+    if (mismatches > 0)
+    {
+        printf("\nVERIFY %d:    %lld mismatched results (local sizes %zu elements, %zu results), first mismatched indices: ",
+            my_rank, mismatches, original_array.size(), final_results_array.size());
+        for (size_t i = 0; i < mismatched_indices.size(); i++)
+        {
+            printf("%d ", mismatched_indices[i]);
+        }
+    }
+
+    MPI_Op combine_op;
+    MPI_Op_create(combine_verification, 1, &combine_op);
+    double local_summary[2] = { max_error, (double) mismatches };
+    double global_summary[2];
+    MPI_Allreduce(local_summary, global_summary, 2, MPI_DOUBLE, combine_op, comm);
+    MPI_Op_free(&combine_op);
+
+    if (my_rank == 0)
+    {
+        printf("\nVERIFY %d:    %s, maximum error %g, %.0f mismatched results (tolerance %g)\n",
+            my_rank, global_summary[1] == 0 ? "PASSED" : "FAILED", global_summary[0], global_summary[1], options.verify_tolerance);
+    }
+
+    return global_summary[1] == 0;
+}
+
+
+// Order-sensitive checksums of the data moved in each phase of the pipeline
+// Every element contributes mix(global position, value bits) and the contributions are added (mod 2^64), so the sum
+// of what all senders hashed must equal the sum of what all receivers hashed, independent of how the data was split
+enum pipeline_phase { GATHER_ELEMENTS, SCATTER_TASKS, GATHER_RESULTS, RETURN_RESULTS, NUMBER_OF_PHASES };
+
+const char* phase_names[NUMBER_OF_PHASES] = { "gather elements", "scatter tasks", "gather results", "return results" };
+
+struct phase_checksums
+{
+    uint64_t sent[NUMBER_OF_PHASES] = {};
+    uint64_t received[NUMBER_OF_PHASES] = {};
+};
+
+template <typename T>
+uint64_t position_weighted_hash(const T* values, int count, long long first_position)
+{
+    static_assert(sizeof(T) == sizeof(uint32_t), "hash expects 32-bit elements");
+
+    uint64_t hash = 0;
+    for (int i = 0; i < count; i++)
+    {
+        uint32_t bits;
+        memcpy(&bits, &values[i], sizeof(bits));
+
+        // splitmix64 finalizer of the position combined with the value
+        uint64_t x = (uint64_t) (first_position + i) * 0x9E3779B97F4A7C15ull + bits;
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+        hash += x ^ (x >> 31);
+    }
+    return hash;
+}
+
+// Sum the checksums of all ranks with one MPI_Allreduce and compare senders against receivers phase by phase
+bool reconcile_checksums(const phase_checksums& checksums, int my_rank, MPI_Comm comm)
+{
+    uint64_t global_checksums[2 * NUMBER_OF_PHASES];
+    MPI_Allreduce(&checksums, global_checksums, 2 * NUMBER_OF_PHASES, MPI_UINT64_T, MPI_SUM, comm);
+
+    bool all_match = true;
+    for (int phase = 0; phase < NUMBER_OF_PHASES; phase++)
+    {
+        uint64_t sent = global_checksums[phase];
+        uint64_t received = global_checksums[NUMBER_OF_PHASES + phase];
+        all_match = all_match && sent == received;
+
+        if (my_rank == 0)
+        {
+            printf("\nCHECKSUM %d:    %-15s sent %016llx received %016llx %s", my_rank, phase_names[phase],
+                (unsigned long long) sent, (unsigned long long) received, sent == received ? "OK" : "MISMATCH");
+        }
+    }
+    if (my_rank == 0)
+    {
+        printf("\n");
+    }
+
+    return all_match;
+}
+
+
+// Equal split of all elements over the ranks, the first (total_elements % total_ranks) ranks take one extra element
+// For ex: if number_of_elements_array is {8, 1, 4, 7} redistribute as redistributed_number_of_elements_array being {5, 5, 5, 5}
+//         if number_of_elements_array is {8, 2, 4, 7} redistribute as redistributed_number_of_elements_array being {6, 5, 5, 5}
+//         if number_of_elements_array is {8, 3, 4, 7} redistribute as redistributed_number_of_elements_array being {6, 6, 5, 5}
+vector<int> plan_redistribution(const vector<int>& number_of_elements_array)
+{
+    int total_ranks = number_of_elements_array.size();
+    int total_elements = accumulate(number_of_elements_array.begin(), number_of_elements_array.end(), 0);
+
+    int base_avg = total_elements / total_ranks;
+    vector<int> redistributed_number_of_elements_array(total_ranks, base_avg);
+
+    int remainder = total_elements % total_ranks;
+
+    for (int i = 0; i < remainder; i++)
+    {
+        redistributed_number_of_elements_array[i] += 1;
+    }
+
+    return redistributed_number_of_elements_array;
+}
+
+
+// Displacements_array (array of index numbers where to store information from each process into buffer array)
+// For ex: for number of elements to be sent array as {a, b, c, ...}
+// The displacements will  be {0, a, a+b, a+b+c, ...}
+// These are needed for MPI_Gatherv/MPI_Scatterv function parameters
+vector<int> compute_displacements(const vector<int>& counts)
+{
+    vector<int> displacements_array;
+    // Intialize new array with 0 (first index of buffer array)
+    displacements_array.push_back(0);
+
+    for (size_t i = 0; i + 1 < counts.size(); i++)
+    {
+        displacements_array.push_back(displacements_array[i] + counts[i]);
+    }
+
+    return displacements_array;
+}
+
+
+// Run log used by --record and --replay
+// Layout: magic "MPIRUNLG", int32 version, total_ranks, max_elements, distribution (index into distribution_names),
+// followed by total_ranks uint32 seeds, total_ranks int32 element counts and total_ranks int32 planned counts
+const char run_log_magic[8] = { 'M', 'P', 'I', 'R', 'U', 'N', 'L', 'G' };
+const int32_t run_log_version = 1;
+const char* distribution_names[] = { "uniform", "skewed", "single" };
+
+struct run_log
+{
+    int32_t max_elements = 0;
+    int32_t distribution = 0;
+    vector<uint32_t> seeds;
+    vector<int32_t> counts;
+    vector<int32_t> plan;
+};
+
+// Gather the seeds and counts at rank 0 and write them together with the plan (collective)
+void record_run(const string& path, unsigned int seed, int num_elements, int my_rank, int total_ranks, const run_options& options, MPI_Comm comm)
+{
+    run_log log;
+    log.seeds.resize(total_ranks);
+    log.counts.resize(total_ranks);
+
+    uint32_t my_seed = seed;
+    int32_t my_count = num_elements;
+    MPI_Gather(&my_seed, 1, MPI_UINT32_T, log.seeds.data(), 1, MPI_UINT32_T, 0, comm);
+    MPI_Gather(&my_count, 1, MPI_INT32_T, log.counts.data(), 1, MPI_INT32_T, 0, comm);
+
+    if (my_rank != 0)
+    {
+        return;
+    }
+
+    log.max_elements = options.max_elements;
+    log.distribution = find(begin(distribution_names), end(distribution_names), options.distribution) - begin(distribution_names);
+    log.plan = plan_redistribution(vector<int>(log.counts.begin(), log.counts.end()));
+
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Cannot open run log %s for writing\n", path.c_str());
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    int32_t header[4] = { run_log_version, total_ranks, log.max_elements, log.distribution };
+    size_t ranks = total_ranks;
+    bool written = fwrite(run_log_magic, 1, sizeof(run_log_magic), file) == sizeof(run_log_magic) &&
+        fwrite(header, sizeof(int32_t), 4, file) == 4 &&
+        fwrite(log.seeds.data(), sizeof(uint32_t), ranks, file) == ranks &&
+        fwrite(log.counts.data(), sizeof(int32_t), ranks, file) == ranks &&
+        fwrite(log.plan.data(), sizeof(int32_t), ranks, file) == ranks;
+    if (fclose(file) != 0 || !written)
+    {
+        fprintf(stderr, "Failed to write run log %s\n", path.c_str());
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    printf("\nRECORD %d:    Wrote run log %s for %d ranks\n", my_rank, path.c_str(), total_ranks);
+}
+
+// Read a run log on rank 0, check it against the current run and hand every rank its recorded seed and count (collective)
+// The generation options in options are replaced by the recorded ones
+void replay_run(const string& path, unsigned int& seed, int& recorded_count, int my_rank, int total_ranks, run_options& options, MPI_Comm comm)
+{
+    run_log log;
+    int32_t header[4] = {};
+
+    if (my_rank == 0)
+    {
+        FILE* file = fopen(path.c_str(), "rb");
+        if (file == NULL)
+        {
+            fprintf(stderr, "Cannot open run log %s\n", path.c_str());
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+
+        char magic[sizeof(run_log_magic)];
+        bool valid = fread(magic, 1, sizeof(magic), file) == sizeof(magic) && memcmp(magic, run_log_magic, sizeof(magic)) == 0 &&
+            fread(header, sizeof(int32_t), 4, file) == 4 && header[0] == run_log_version;
+        if (!valid || header[1] != total_ranks || header[3] < 0 || header[3] > 2)
+        {
+            fprintf(stderr, "%s is not a valid run log for %d ranks\n", path.c_str(), total_ranks);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+
+        size_t ranks = total_ranks;
+        log.seeds.resize(ranks);
+        log.counts.resize(ranks);
+        log.plan.resize(ranks);
+        if (fread(log.seeds.data(), sizeof(uint32_t), ranks, file) != ranks ||
+            fread(log.counts.data(), sizeof(int32_t), ranks, file) != ranks ||
+            fread(log.plan.data(), sizeof(int32_t), ranks, file) != ranks)
+        {
+            fprintf(stderr, "Run log %s is truncated\n", path.c_str());
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        fclose(file);
+
+        // A different plan for the same counts means the plan code changed since the recording
+        vector<int> plan = plan_redistribution(vector<int>(log.counts.begin(), log.counts.end()));
+        if (!equal(plan.begin(), plan.end(), log.plan.begin()))
+        {
+            printf("\nREPLAY %d:    Warning: the current plan differs from the recorded one", my_rank);
+        }
+        printf("\nREPLAY %d:    Replaying run log %s for %d ranks\n", my_rank, path.c_str(), total_ranks);
+    }
+
+    MPI_Bcast(header, 4, MPI_INT32_T, 0, comm);
+    options.max_elements = header[2];
+    options.distribution = distribution_names[header[3]];
+
+    uint32_t my_seed;
+    int32_t my_count;
+    MPI_Scatter(log.seeds.data(), 1, MPI_UINT32_T, &my_seed, 1, MPI_UINT32_T, 0, comm);
+    MPI_Scatter(log.counts.data(), 1, MPI_INT32_T, &my_count, 1, MPI_INT32_T, 0, comm);
+    seed = my_seed;
+    recorded_count = my_count;
+}
+
+
+// The task performed on every element after redistribution, any element-wise formula of kernel_x works (see MPI_Kernel.h)
+const auto task_kernel = sin(deg2rad(kernel_x));
+
+// Identifies the task in result cache keys, so changing the formula never serves stale results
+const string task_kernel_id = "float " + task_kernel.describe();
+
+
+// Gather all elements at rank 0, redistribute them equally, perform the task and send the results back to their owners
+// When checksums is not null the data sent and received in every phase is hashed into it
+// When compression_stats is not null every message is compressed with options.compression and counted into it
+// With options.threads > 1 the task runs on the work-stealing scheduler, which counts into scheduler_stats when it is not null
+// When on_chunk is not null the results return in chunks of options.result_chunk_elements and it is called for each one as it lands
+void run_pipeline(const vector<int>& original_array, vector<float>& final_results_array, int my_rank, int total_ranks, const run_options& options,
+    phase_checksums* checksums, compression_statistics* compression_stats, work_stealing_statistics* scheduler_stats, const result_chunk_callback* on_chunk,
+    MPI_Comm comm)
+{
+    int num_elements = original_array.size();
+
+    int total_elements = 0;
+    // Collect all num_elements at master rank (assumed as rank 0)
+    vector<int> number_of_elements_array(total_ranks);  // buffer to store gathered information from all processes
+    MPI_Gather(&num_elements, 1, MPI_INT, number_of_elements_array.data(), 1, MPI_INT, 0, comm);
+
+
+    if (my_rank == 0)
+    {
+        // Sum all members of number_of_elements_array to calculate total number of elements of interest (needed later)
+        total_elements = accumulate(number_of_elements_array.begin(), number_of_elements_array.end(), 0);
+        if (!options.quiet)
+        {
+            printf("\n\nTotal elements are %d", total_elements);
+        }
+    }
+
+
+    // Displacements of every rank's elements in the sequential array (see compute_displacements)
+    vector<int> displacements_array_2;
+    
+
+    if  (my_rank == 0)
+    {
+        displacements_array_2 = compute_displacements(number_of_elements_array);
+    }
+
+
+    // Create new buffer to store all elements *sequentially* from all processes in a single array
+    // For processes {A, B, C, ...}
+    // The stored elements array will be {a_1, a_2, ..., b_1, b_2, ..., c_1, c_2, ..., ...}
+    vector<int> combined_task_array(total_elements);
+    // Collect individual elements from all processes sequentially into a single array
+    if (compression_stats != nullptr)
+    {
+        compressed_gatherv(original_array.data(), num_elements, combined_task_array.data(), number_of_elements_array.data(),
+            displacements_array_2.data(), 0, comm, options.compression, *compression_stats);
+    }
+    else
+    {
+        MPI_Gatherv(original_array.data(), num_elements, MPI_INT,
+            combined_task_array.data(), number_of_elements_array.data(), displacements_array_2.data(), MPI_INT, 0, comm);
+    }
+    vector<int> redistributed_number_of_elements_array(total_ranks);
+
+    // Global position of this rank's first element in the original layout (only rank 0 knows displacements_array_2)
+    long long original_offset = 0;
+    if (checksums != nullptr)
+    {
+        long long local_count = num_elements;
+        MPI_Exscan(&local_count, &original_offset, 1, MPI_LONG_LONG, MPI_SUM, comm);
+        original_offset = (my_rank == 0) ? 0 : original_offset;
+
+        checksums->sent[GATHER_ELEMENTS] = position_weighted_hash(original_array.data(), num_elements, original_offset);
+        checksums->received[GATHER_ELEMENTS] = position_weighted_hash(combined_task_array.data(), total_elements, 0);
+    }
+    
+    MPI_Barrier(comm);
+
+    if (my_rank == 0)
+    {    
+        if (!options.quiet)
+        {
+            printf("\n\nPROGRESS %d:    The number of elements in processes 0 to %d are: ", my_rank, total_ranks - 1);
+            for (int i = 0; i < total_ranks; i++)
+            {
+                printf("%d ", number_of_elements_array[i]);
+            }
+
+            printf("\nPROGRESS %d:    The sequential array of all elements is (from process 0 to %d): ", my_rank, total_ranks - 1);
+            for (int i = 0; i < total_elements; i++)
+            {
+                printf("%d ", combined_task_array[i]);
+            }
+        }
+
+        // Next: distribute elements equally via process 0
+        // Create array to hold the number of elements in each process after redistribution
+        redistributed_number_of_elements_array = plan_redistribution(number_of_elements_array);
+    }
+
+
+    int num_received_tasks;
+    // Scatter equalized number of elements that is needed in other processes
+    MPI_Scatter(redistributed_number_of_elements_array.data(), 1, MPI_INT, &num_received_tasks, 1, MPI_INT, 0, comm);
+
+
+    // Again create displacements_array as a parameter to MPI_Scatterv
+    vector<int> displacements_array_3;
+    // Declare buffer to store task_array that will have elements on which the task needs to be performed
+    vector<int> task_array(num_received_tasks);
+
+
+    if (my_rank == 0)
+    {   
+        // Print redistributed array
+        if (!options.quiet)
+        {
+            printf("\nPROGRESS %d:    The targetted redistribution array is: ", my_rank);
+            for (int i = 0; i < total_ranks; i++)
+            {
+                printf("%d ", redistributed_number_of_elements_array[i]);
+            }
+        }
+    
+        displacements_array_3 = compute_displacements(redistributed_number_of_elements_array);
+    }
+
+    MPI_Barrier(comm);
+    // Redistribute elements equally to perform a task
+    if (compression_stats != nullptr)
+    {
+        compressed_scatterv(combined_task_array.data(), redistributed_number_of_elements_array.data(), displacements_array_3.data(), task_array.data(),
+            num_received_tasks, 0, comm, options.compression, *compression_stats);
+    }
+    else
+    {
+        MPI_Scatterv(combined_task_array.data(), redistributed_number_of_elements_array.data(), displacements_array_3.data(), MPI_INT, task_array.data(),
+            num_received_tasks, MPI_INT, 0, comm);
+    }
+
+    // Global position of this rank's first element in the balanced layout
+    long long balanced_offset = 0;
+    if (checksums != nullptr)
+    {
+        long long local_count = num_received_tasks;
+        MPI_Exscan(&local_count, &balanced_offset, 1, MPI_LONG_LONG, MPI_SUM, comm);
+        balanced_offset = (my_rank == 0) ? 0 : balanced_offset;
+
+        checksums->sent[SCATTER_TASKS] = position_weighted_hash(combined_task_array.data(), total_elements, 0);
+        checksums->received[SCATTER_TASKS] = position_weighted_hash(task_array.data(), num_received_tasks, balanced_offset);
+    }
+
+    
+    // Print statements to check the distributed elements
+    if (!options.quiet)
+    {
+        if (my_rank == 0)
+        {
+            printf("\n");
+        }
+        printf("\nTASK %d:    Hello! I am process %d and my task array is: ", my_rank, my_rank);
+        for (int i = 0; i < num_received_tasks; i++)
+        {
+            printf("%d ", task_array[i]);
+        }
+    }
+
+
+    // Perform the task
+    vector<float> results_array(num_received_tasks);
+
+    if (options.threads > 1)
+    {
+        parallel_for_stealing(num_received_tasks, options.threads, options.grain, [&](size_t begin, size_t end)
+        {
+            apply_kernel(task_kernel, task_array.data() + begin, results_array.data() + begin, end - begin);
+        }, scheduler_stats);
+    }
+    else
+    {
+        apply_kernel(task_kernel, task_array.data(), results_array.data(), num_received_tasks);
+    }
+    
+
+    // Gather results
+    vector<float> combined_results_array(total_elements);
+    if (compression_stats != nullptr)
+    {
+        compressed_gatherv(results_array.data(), num_received_tasks, combined_results_array.data(), redistributed_number_of_elements_array.data(),
+            displacements_array_3.data(), 0, comm, options.compression, *compression_stats);
+    }
+    else
+    {
+        MPI_Gatherv(results_array.data(), num_received_tasks, MPI_FLOAT,
+            combined_results_array.data(), redistributed_number_of_elements_array.data(), displacements_array_3.data(), MPI_FLOAT, 0, comm);
+    }
+
+    if (checksums != nullptr)
+    {
+        checksums->sent[GATHER_RESULTS] = position_weighted_hash(results_array.data(), num_received_tasks, balanced_offset);
+        checksums->received[GATHER_RESULTS] = position_weighted_hash(combined_results_array.data(), total_elements, 0);
+    }
+
+
+    if (my_rank == 0 && !options.quiet)
+    {
+        // Print combined results array
+        printf("\n\nRESULT %d:    The combined results array is: ", my_rank);
+        for (int i = 0; i < total_elements; i++)
+        {
+            printf("%f ", combined_results_array[i]);
+        }
+    }
+
+
+    final_results_array.resize(num_elements);
+    // Send back results to original processes;
+    if (compression_stats != nullptr)
+    {
+        compressed_scatterv(combined_results_array.data(), number_of_elements_array.data(), displacements_array_2.data(),
+            final_results_array.data(), num_elements, 0, comm, options.compression, *compression_stats);
+    }
+    else if (on_chunk != nullptr)
+    {
+        scatter_result_chunks(combined_results_array.data(), number_of_elements_array.data(), displacements_array_2.data(), final_results_array.data(),
+            num_elements, options.result_chunk_elements, 0, comm, *on_chunk);
+    }
+    else
+    {
+        MPI_Scatterv(combined_results_array.data(), number_of_elements_array.data(), displacements_array_2.data(), MPI_FLOAT, 
+            final_results_array.data(), num_elements, MPI_FLOAT, 0, comm);
+    }
+
+    if (checksums != nullptr)
+    {
+        checksums->sent[RETURN_RESULTS] = position_weighted_hash(combined_results_array.data(), total_elements, 0);
+        checksums->received[RETURN_RESULTS] = position_weighted_hash(final_results_array.data(), num_elements, original_offset);
+    }
+}
+
+
+// Streaming run: push every rank's elements through the pipeline options.batch_elements at a time, batch b holds elements
+// [b * batch_elements, (b + 1) * batch_elements) of every rank (fewer or none on ranks that run out), the results of batches before
+// first_batch must already be in final_results_array
+// When checkpoints is not null a checkpoint is started after every options.checkpoint_every batches and after the last batch
+void run_stream(const vector<int>& original_array, vector<float>& final_results_array, int first_batch, int total_batches, int my_rank, int total_ranks,
+    const run_options& options, phase_checksums* checksums, compression_statistics* compression_stats, work_stealing_statistics* scheduler_stats,
+    const result_chunk_callback* on_chunk, checkpoint_writer* checkpoints, MPI_Comm comm)
+{
+    int num_elements = original_array.size();
+    final_results_array.resize(num_elements);
+
+    vector<int> batch_array;
+    vector<float> batch_results_array;
+    for (int batch = first_batch; batch < total_batches; batch++)
+    {
+        int first = min((long long) batch * options.batch_elements, (long long) num_elements);
+        int last = min((long long) first + options.batch_elements, (long long) num_elements);
+        batch_array.assign(original_array.begin() + first, original_array.begin() + last);
+
+        // Chunks of the batch are passed on at their position among all of the rank's results
+        result_chunk_callback batch_chunk;
+        if (on_chunk != nullptr)
+        {
+            batch_chunk = [&](const float* chunk, int chunk_first, int count)
+            {
+                (*on_chunk)(chunk, first + chunk_first, count);
+            };
+        }
+
+        // Senders and receivers balance within every batch, so the per-batch checksums can simply be added up
+        phase_checksums batch_checksums;
+        run_pipeline(batch_array, batch_results_array, my_rank, total_ranks, options, checksums != nullptr ? &batch_checksums : nullptr,
+            compression_stats, scheduler_stats, on_chunk != nullptr ? &batch_chunk : nullptr, comm);
+        copy(batch_results_array.begin(), batch_results_array.end(), final_results_array.begin() + first);
+
+        if (checksums != nullptr)
+        {
+            for (int phase = 0; phase < NUMBER_OF_PHASES; phase++)
+            {
+                checksums->sent[phase] += batch_checksums.sent[phase];
+                checksums->received[phase] += batch_checksums.received[phase];
+            }
+        }
+
+        if (checkpoints != nullptr && ((batch + 1) % options.checkpoint_every == 0 || batch + 1 == total_batches))
+        {
+            start_checkpoint(*checkpoints, batch + 1, last);
+        }
+    }
+}
+
+
+// The pipeline as a dataflow graph: the task requires the balanced layout and its results go back to the elements' owners
+void run_dataflow(const vector<int>& original_array, vector<float>& final_results_array, int my_rank, bool report, MPI_Comm comm)
+{
+    dataflow_graph graph(vector<float>(original_array.begin(), original_array.end()), plan_redistribution, comm);
+    graph.map(task_kernel, BALANCED_LAYOUT).collect();
+
+    if (report && my_rank == 0)
+    {
+        printf("\nDATAFLOW %d:    pipeline plan: %s\n", my_rank, graph.describe().c_str());
+    }
+
+    // Every rank plans the same stages, so a planning error is the same on all of them
+    string error;
+    if (!graph.execute(error))
+    {
+        if (my_rank == 0)
+        {
+            fprintf(stderr, "Dataflow pipeline cannot run: %s\n", error.c_str());
+        }
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    final_results_array.swap(graph.values);
+}
+
+
+// Moving average of radius over the results in the balanced layout, computed with a halo exchange
+// With verify the averages are compared on rank 0 with a sequential computation over all gathered results
+bool smooth_results(const vector<float>& final_results_array, int radius, int my_rank, bool verify, MPI_Comm comm)
+{
+    dist_vector<float> results(final_results_array, plan_redistribution, comm);
+    results.balance();
+
+    MPI_Barrier(comm);
+    double start_time = MPI_Wtime();
+    dist_vector<float> averages = apply_stencil<float>(results, radius, moving_average_stencil());
+    double elapsed_time = MPI_Wtime() - start_time;
+    double slowest_time;
+    MPI_Reduce(&elapsed_time, &slowest_time, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+
+    vector<float> all_results;
+    vector<float> all_averages;
+    if (verify)
+    {
+        all_results = results.gather_to(0);
+        all_averages = averages.gather_to(0);
+    }
+
+    if (my_rank != 0)
+    {
+        return true;
+    }
+    printf("\nHALO %d:    Moving average of radius %d over %lld balanced results in %.6f s\n", my_rank, radius, results.size(), slowest_time);
+    if (!verify)
+    {
+        return true;
+    }
+
+    double max_error = 0.0;
+    long long size = all_results.size();
+    for (long long i = 0; i < size; i++)
+    {
+        long long first = max(0LL, i - radius);
+        long long last = min(size - 1, i + (long long) radius);
+        double sum = 0.0;
+        for (long long j = first; j <= last; j++)
+        {
+            sum += all_results[j];
+        }
+        max_error = max(max_error, fabs(sum / (last - first + 1) - all_averages[i]));
+    }
+    printf("\nHALO %d:    %s, maximum error %g against the sequential moving average\n", my_rank, max_error <= 1e-6 ? "PASSED" : "FAILED", max_error);
+    return max_error <= 1e-6;
+}
+
+
+// Inclusive and exclusive cumulative sums of the results in the balanced layout, accumulated in double
+// With verify both are compared on rank 0 with sequential sums over all gathered results
+bool scan_results(const vector<float>& final_results_array, int my_rank, bool verify, MPI_Comm comm)
+{
+    dist_vector<float> results(final_results_array, plan_redistribution, comm);
+    results.balance();
+
+    MPI_Barrier(comm);
+    double start_time = MPI_Wtime();
+    dist_vector<double> inclusive = inclusive_scan<double>(results);
+    double elapsed_time = MPI_Wtime() - start_time;
+    dist_vector<double> exclusive = exclusive_scan<double>(results);
+
+    // The last element of the inclusive scan is the sum of all results
+    bool holds_last = !inclusive.local.empty() && inclusive.global_offset() + (long long) inclusive.local.size() == inclusive.size();
+    double local_total = holds_last ? inclusive.local.back() : 0.0;
+    double slowest_time;
+    double total;
+    MPI_Reduce(&elapsed_time, &slowest_time, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+    MPI_Reduce(&local_total, &total, 1, MPI_DOUBLE, MPI_SUM, 0, comm);
+
+    vector<float> all_results;
+    vector<double> all_inclusive;
+    vector<double> all_exclusive;
+    if (verify)
+    {
+        all_results = results.gather_to(0);
+        all_inclusive = inclusive.gather_to(0);
+        all_exclusive = exclusive.gather_to(0);
+    }
+
+    if (my_rank != 0)
+    {
+        return true;
+    }
+    printf("\nSCAN %d:    Inclusive scan of %lld balanced results in %.6f s, sum of all results %f\n", my_rank, results.size(), slowest_time, total);
+    if (!verify)
+    {
+        return true;
+    }
+
+    // The distributed sums add the same values in a different grouping, so allow rounding relative to the running sum
+    double max_error = 0.0;
+    double sum = 0.0;
+    bool passed = true;
+    for (size_t i = 0; i < all_results.size(); i++)
+    {
+        double error = max(fabs(all_exclusive[i] - sum), fabs(all_inclusive[i] - (sum + all_results[i])));
+        sum += all_results[i];
+        max_error = max(max_error, error);
+        passed = passed && error <= 1e-9 * max(1.0, fabs(sum));
+    }
+    printf("\nSCAN %d:    %s, maximum error %g against sequential inclusive and exclusive sums\n", my_rank, passed ? "PASSED" : "FAILED", max_error);
+    return passed;
+}
+
+
+// Quantiles and the largest results over all ranks by distributed selection
+// With verify all results are gathered and sorted on rank 0 and the selected values must match exactly
+bool select_results(const vector<float>& final_results_array, const run_options& options, int my_rank, MPI_Comm comm)
+{
+    MPI_Barrier(comm);
+    double start_time = MPI_Wtime();
+    long long total_results;
+    vector<float> quantiles = distributed_quantiles(final_results_array, options.quantiles, total_results, comm);
+    vector<float> top = distributed_top_k(final_results_array, options.top_k, 0, comm);
+    double elapsed_time = MPI_Wtime() - start_time;
+    double slowest_time;
+    MPI_Reduce(&elapsed_time, &slowest_time, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+
+    vector<float> sorted_results;
+    if (options.verify)
+    {
+        dist_vector<float> results(final_results_array, plan_redistribution, comm);
+        sorted_results = results.gather_to(0);
+        sort(sorted_results.begin(), sorted_results.end());
+    }
+
+    if (my_rank != 0)
+    {
+        return true;
+    }
+    bool passed = true;
+    printf("\nSELECT %d:    Selected from %lld results in %.6f s", my_rank, total_results, slowest_time);
+    for (size_t i = 0; i < options.quantiles.size(); i++)
+    {
+        printf("\nSELECT %d:    p%g = %f", my_rank, options.quantiles[i] * 100.0, quantiles[i]);
+        if (options.verify && total_results > 0)
+        {
+            passed = passed && quantiles[i] == sorted_results[(long long) floor(options.quantiles[i] * (total_results - 1))];
+        }
+    }
+    if (options.top_k > 0)
+    {
+        printf("\nSELECT %d:    top %zu: ", my_rank, top.size());
+        for (size_t i = 0; i < top.size(); i++)
+        {
+            printf("%f ", top[i]);
+        }
+        if (options.verify)
+        {
+            passed = passed && equal(top.begin(), top.end(), sorted_results.rbegin());
+        }
+    }
+    if (options.verify)
+    {
+        printf("\nSELECT %d:    %s against the sorted results", my_rank, passed ? "PASSED" : "FAILED");
+    }
+    printf("\n");
+    return passed;
+}
+
+
+// The pipeline balanced by diffusion between neighboring ranks instead of through rank 0, the results return to their owners
+// by replaying the logged transfers backwards
+void run_diffusion(const vector<int>& original_array, vector<float>& final_results_array, int my_rank, const run_options& options, bool report,
+    MPI_Comm comm)
+{
+    const int max_rounds = 1000;
+    diffusion_topology topology = (options.diffusion == "ring") ? RING_TOPOLOGY : HYPERCUBE_TOPOLOGY;
+
+    vector<int> task_array = original_array;
+    diffusion_log log = diffuse_load(task_array, topology, options.diffusion_tolerance, max_rounds, comm);
+
+    final_results_array.resize(task_array.size());
+    apply_kernel(task_kernel, task_array.data(), final_results_array.data(), task_array.size());
+    undo_diffusion(final_results_array, log, comm);
+
+    if (report)
+    {
+        long long moved;
+        MPI_Reduce(&log.moved, &moved, 1, MPI_LONG_LONG, MPI_SUM, 0, comm);
+        if (my_rank == 0)
+        {
+            printf("\nDIFFUSION %d:    %s balanced to imbalance %.4f in %d rounds (%zu steps), %lld elements moved between neighbors\n", my_rank,
+                diffusion_topology_names[topology], log.imbalance, log.rounds, log.steps.size(), moved);
+        }
+    }
+}
+
+
+// Downstream consumer of the streamed results: sums every chunk as it lands, records when the first and the last chunk of the
+// current run arrived and counts the chunks that did not start where the previous one ended
+struct result_consumer
+{
+    long long chunks = 0;
+    long long elements = 0;
+    long long out_of_order_chunks = 0;
+    int next_first = 0;
+    double sum = 0.0;
+    double start_time = 0.0;
+    double first_chunk_time = 0.0;
+    double last_chunk_time = 0.0;
+
+    void start(double time)
+    {
+        start_time = time;
+        first_chunk_time = -1.0;
+        last_chunk_time = 0.0;
+        next_first = 0;
+        sum = 0.0;
+    }
+
+    void consume(const float* chunk, int first, int count)
+    {
+        double now = MPI_Wtime() - start_time;
+        first_chunk_time = (first_chunk_time < 0.0) ? now : first_chunk_time;
+        last_chunk_time = now;
+        sum = accumulate(chunk, chunk + count, sum);
+        chunks++;
+        elements += count;
+        out_of_order_chunks += (first != next_first) ? 1 : 0;
+        next_first = first + count;
+    }
+};
+
+
+// Results and chunks of results accepted by their owners, and how many arrived after a chunk that follows them in the owner's array
+struct return_statistics
+{
+    long long chunks = 0;
+    long long elements = 0;
+    long long reordered_chunks = 0;
+};
+
+// Move the --dist-vector results back to the elements' owners, with unordered chunk by chunk as they arrive (collective)
+void return_results(dist_vector<float>& results, bool unordered, return_statistics& stats)
+{
+    if (!unordered)
+    {
+        results.restore_original_layout();
+        return;
+    }
+
+    int last_index = -1;
+    results.restore_unordered([&](int first, int count)
+    {
+        stats.chunks++;
+        stats.elements += count;
+        stats.reordered_chunks += (first < last_index) ? 1 : 0;
+        last_index = max(last_index, first);
+    });
+}
+
+
+// The pipeline with one-sided transfers: every rank pulls its balanced range from the owners' elements and puts the results
+// back into the owners' result arrays, no rank posts a receive or routes data through rank 0
+void run_rma(const vector<int>& original_array, vector<float>& final_results_array, int my_rank, bool report, MPI_Comm comm)
+{
+    int total_ranks;
+    MPI_Comm_size(comm, &total_ranks);
+
+    int num_elements = original_array.size();
+    vector<int> number_of_elements_array(total_ranks);
+    MPI_Allgather(&num_elements, 1, MPI_INT, number_of_elements_array.data(), 1, MPI_INT, comm);
+    dist_layout original(number_of_elements_array);
+    dist_layout balanced(plan_redistribution(number_of_elements_array));
+
+    int gets;
+    vector<int> task_array = rma_pull(original_array, original, balanced, gets, comm);
+
+    vector<float> results_array(task_array.size());
+    apply_kernel(task_kernel, task_array.data(), results_array.data(), task_array.size());
+
+    int puts;
+    final_results_array.resize(num_elements);
+    rma_push(results_array, balanced, final_results_array, original, puts, comm);
+
+    if (report)
+    {
+        int local_transfers[2] = { gets, puts };
+        int transfers[2];
+        MPI_Reduce(local_transfers, transfers, 2, MPI_INT, MPI_SUM, 0, comm);
+        if (my_rank == 0)
+        {
+            printf("\nRMA %d:    balanced ranges pulled with %d MPI_Get calls, results returned with %d MPI_Put calls\n", my_rank, transfers[0], transfers[1]);
+        }
+    }
+}
+
+
+// Random count vector for the plan stress test, cycling through the edge cases the plan has to handle
+vector<int> random_counts(mt19937& generator, int total_ranks, int test_case)
+{
+    vector<int> counts(total_ranks, 0);
+    uniform_int_distribution<int> random_rank(0, total_ranks - 1);
+
+    switch (test_case % 6)
+    {
+        case 0:
+            // Every rank is empty
+            break;
+
+        case 1:
+        {
+            // Fewer elements than ranks
+            int total_elements = uniform_int_distribution<int>(1, total_ranks)(generator) - 1;
+            for (int i = 0; i < total_elements; i++)
+            {
+                counts[random_rank(generator)]++;
+            }
+            break;
+        }
+
+        case 2:
+            // One rank holds everything
+            counts[random_rank(generator)] = uniform_int_distribution<int>(1, 20000)(generator);
+            break;
+
+        case 3:
+            // Roughly half of the ranks are empty
+            for (int i = 0; i < total_ranks; i++)
+            {
+                counts[i] = (generator() % 2) ? uniform_int_distribution<int>(0, 1000)(generator) : 0;
+            }
+            break;
+
+        case 4:
+            // Small counts as in the demo run
+            for (int i = 0; i < total_ranks; i++)
+            {
+                counts[i] = uniform_int_distribution<int>(0, 9)(generator);
+            }
+            break;
+
+        default:
+            // Skewed counts with a long tail
+            for (int i = 0; i < total_ranks; i++)
+            {
+                counts[i] = uniform_int_distribution<int>(0, 10000 / (i + 1))(generator);
+            }
+            break;
+    }
+
+    return counts;
+}
+
+
+// Check the plan for one count vector and move data through it in-process (a plain copy standing in for each
+// MPI_Gatherv/MPI_Scatterv), returns an empty string when all invariants hold or the first broken one
+string check_plan(const vector<int>& counts)
+{
+    int total_ranks = counts.size();
+    int total_elements = accumulate(counts.begin(), counts.end(), 0);
+    vector<int> plan = plan_redistribution(counts);
+
+    if (plan.size() != counts.size())
+    {
+        return "plan has the wrong number of ranks";
+    }
+    if (accumulate(plan.begin(), plan.end(), 0) != total_elements)
+    {
+        return "plan does not conserve the number of elements";
+    }
+    if (*min_element(plan.begin(), plan.end()) < 0)
+    {
+        return "plan assigns a negative count";
+    }
+    if (*max_element(plan.begin(), plan.end()) - *min_element(plan.begin(), plan.end()) > 1)
+    {
+        return "plan is not balanced within 1";
+    }
+    if (!is_sorted(plan.rbegin(), plan.rend()))
+    {
+        return "extra elements are not on the first ranks";
+    }
+
+    vector<int> displacements_array_2 = compute_displacements(counts);
+    vector<int> displacements_array_3 = compute_displacements(plan);
+    for (int i = 0; i < total_ranks; i++)
+    {
+        int next_2 = (i + 1 < total_ranks) ? displacements_array_2[i + 1] : total_elements;
+        int next_3 = (i + 1 < total_ranks) ? displacements_array_3[i + 1] : total_elements;
+        if (displacements_array_2[i] + counts[i] != next_2 || displacements_array_3[i] + plan[i] != next_3)
+        {
+            return "displacements do not tile the sequential array";
+        }
+    }
+
+    // Elements are their own global position, results are the negated positions
+    vector<int> combined_task_array(total_elements);
+    for (int rank = 0; rank < total_ranks; rank++)
+    {
+        for (int i = 0; i < counts[rank]; i++)
+        {
+            combined_task_array[displacements_array_2[rank] + i] = displacements_array_2[rank] + i;
+        }
+    }
+
+    vector<int> combined_results_array(total_elements);
+    for (int rank = 0; rank < total_ranks; rank++)
+    {
+        for (int i = 0; i < plan[rank]; i++)
+        {
+            int task = combined_task_array[displacements_array_3[rank] + i];
+            if (task != displacements_array_3[rank] + i)
+            {
+                return "task array is out of order";
+            }
+            combined_results_array[displacements_array_3[rank] + i] = -task;
+        }
+    }
+
+    for (int rank = 0; rank < total_ranks; rank++)
+    {
+        for (int i = 0; i < counts[rank]; i++)
+        {
+            if (combined_results_array[displacements_array_2[rank] + i] != -(displacements_array_2[rank] + i))
+            {
+                return "result returned to the wrong owner or position";
+            }
+        }
+    }
+
+    return "";
+}
+
+
+// Property-based stress test of the redistribution plan
+// The in-process cases (1 to 64 simulated ranks) are shared out over the ranks, every 100th case is also run through
+// the real MPI pipeline with the communicator's size and its results compared with a local reference
+bool run_plan_stress_test(int my_rank, int total_ranks, const run_options& options)
+{
+    const int max_simulated_ranks = 64;
+    const int mpi_case_interval = 100;
+
+    run_options pipeline_options;
+    pipeline_options.quiet = true;
+
+    long long failures = 0;
+    for (int test_case = 0; test_case < options.stress_cases; test_case++)
+    {
+        // Each case has its own generator so it can be repeated from the seed alone
+        mt19937 generator(options.stress_seed + test_case);
+        bool mpi_case = test_case % mpi_case_interval == 0;
+
+        int simulated_ranks = mpi_case ? total_ranks : uniform_int_distribution<int>(1, max_simulated_ranks)(generator);
+        vector<int> counts = random_counts(generator, simulated_ranks, test_case);
+
+        string failure;
+        if (test_case % total_ranks == my_rank)
+        {
+            failure = check_plan(counts);
+        }
+
+        if (mpi_case)
+        {
+            // Every rank holds counts[my_rank] elements whose value depends on their global position
+            int original_offset = accumulate(counts.begin(), counts.begin() + my_rank, 0);
+            vector<int> original_array(counts[my_rank]);
+            for (int i = 0; i < counts[my_rank]; i++)
+            {
+                original_array[i] = (long long) (original_offset + i) * 37 % 181;
+            }
+
+            vector<float> final_results_array;
+            run_pipeline(original_array, final_results_array, my_rank, total_ranks, pipeline_options, nullptr, nullptr, nullptr, nullptr, MPI_COMM_WORLD);
+
+            bool matches = final_results_array.size() == original_array.size();
+            for (size_t i = 0; matches && i < original_array.size(); i++)
+            {
+                matches = final_results_array[i] == (float) sin(original_array[i] * atan(1) / 45.0);
+            }
+            if (!matches && failure.empty())
+            {
+                failure = "MPI pipeline returned wrong results";
+            }
+        }
+
+        if (!failure.empty())
+        {
+            failures++;
+            printf("\nSTRESS %d:    case %d (seed %u) failed: %s, counts are:", my_rank, test_case, options.stress_seed, failure.c_str());
+            for (int i = 0; i < min<int>(counts.size(), 16); i++)
+            {
+                printf(" %d", counts[i]);
+            }
+            printf(counts.size() > 16 ? " ...\n" : "\n");
+        }
+    }
+
+    long long total_failures;
+    MPI_Allreduce(&failures, &total_failures, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+
+    if (my_rank == 0)
+    {
+        printf("\nSTRESS %d:    %s, %d cases (%d through MPI with %d ranks), %lld failed, seed %u\n", my_rank,
+            total_failures == 0 ? "PASSED" : "FAILED", options.stress_cases, (options.stress_cases + mpi_case_interval - 1) / mpi_case_interval,
+            total_ranks, total_failures, options.stress_seed);
+    }
+
+    return total_failures == 0;
+}
+
+
+// Dedicated I/O ranks
+// The last io_ranks_per_node ranks of every node serve the node's compute ranks, split into contiguous blocks of them
+// Inputs are parsed by the server from each client's byte range and sent to it, results are streamed to the server with
+// nonblocking sends and written by it, so compute ranks never wait on the filesystem and only the servers open files
+const int io_input_tag = 100;
+const int io_result_tag = 101;
+const int io_chunk_elements = 1 << 20;
+
+struct io_layout
+{
+    bool is_server = false;
+    int server = -1;                   // world rank of a compute rank's server
+    vector<int> clients;               // world ranks of a server's compute ranks
+    vector<int> client_compute_ranks;  // and their ranks in compute_comm
+    int compute_size = 0;
+    MPI_Comm compute_comm = MPI_COMM_NULL;
+    MPI_Comm io_comm = MPI_COMM_NULL;
+};
+
+// Choose the servers and split MPI_COMM_WORLD into compute and I/O ranks (collective)
+io_layout setup_io_ranks(int io_ranks_per_node)
+{
+    int world_rank;
+    int world_size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+
+    MPI_Comm node_comm;
+    int node_rank;
+    int node_size;
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, world_rank, MPI_INFO_NULL, &node_comm);
+    MPI_Comm_rank(node_comm, &node_rank);
+    MPI_Comm_size(node_comm, &node_size);
+
+    // Every node needs at least one compute rank
+    int min_compute_ranks = node_size - io_ranks_per_node;
+    MPI_Allreduce(MPI_IN_PLACE, &min_compute_ranks, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+    if (min_compute_ranks < 1)
+    {
+        if (world_rank == 0)
+        {
+            fprintf(stderr, "--io-ranks-per-node %d leaves a node without compute ranks\n", io_ranks_per_node);
+        }
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    io_layout io;
+    io.is_server = node_rank >= node_size - io_ranks_per_node;
+    MPI_Comm_split(MPI_COMM_WORLD, io.is_server ? 1 : 0, world_rank, io.is_server ? &io.io_comm : &io.compute_comm);
+
+    int io_size = 0;
+    if (io.is_server)
+    {
+        MPI_Comm_size(io.io_comm, &io_size);
+    }
+    MPI_Allreduce(MPI_IN_PLACE, &io_size, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+    io.compute_size = world_size - io_size;
+
+    // Everyone on the node learns the world and compute rank of everyone else on the node
+    int compute_rank = -1;
+    if (!io.is_server)
+    {
+        MPI_Comm_rank(io.compute_comm, &compute_rank);
+    }
+    int my_ranks[2] = { world_rank, compute_rank };
+    vector<int> node_ranks(2 * node_size);
+    MPI_Allgather(my_ranks, 2, MPI_INT, node_ranks.data(), 2, MPI_INT, node_comm);
+    MPI_Comm_free(&node_comm);
+
+    int node_compute_ranks = node_size - io_ranks_per_node;
+    for (int i = 0; i < node_compute_ranks; i++)
+    {
+        // Server k serves the compute ranks [k * n / io, (k + 1) * n / io) of the node
+        int server_index = (long long) (i + 1) * io_ranks_per_node / node_compute_ranks;
+        server_index = min(server_index, io_ranks_per_node - 1);
+        while ((long long) server_index * node_compute_ranks / io_ranks_per_node > i)
+        {
+            server_index--;
+        }
+        int server = node_ranks[2 * (node_compute_ranks + server_index)];
+
+        if (node_ranks[2 * i] == world_rank)
+        {
+            io.server = server;
+        }
+        if (server == world_rank)
+        {
+            io.clients.push_back(node_ranks[2 * i]);
+            io.client_compute_ranks.push_back(node_ranks[2 * i + 1]);
+        }
+    }
+
+    return io;
+}
+
+// Parse every client's share of the input file and send it with nonblocking sends (server side)
+void serve_input(const io_layout& io, const run_options& options)
+{
+    vector<vector<int>> client_values(io.clients.size());
+    vector<int> client_counts(io.clients.size());
+    vector<MPI_Request> requests(2 * io.clients.size());
+
+    for (size_t i = 0; i < io.clients.size(); i++)
+    {
+        size_t bytes_read;
+        string error;
+        if (!read_text_input(options.input_file, io.client_compute_ranks[i], io.compute_size, client_values[i], bytes_read, error))
+        {
+            fprintf(stderr, "INPUT:    %s\n", error.c_str());
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+
+        client_counts[i] = client_values[i].size();
+        MPI_Isend(&client_counts[i], 1, MPI_INT, io.clients[i], io_input_tag, MPI_COMM_WORLD, &requests[2 * i]);
+        MPI_Isend(client_values[i].data(), client_counts[i], MPI_INT, io.clients[i], io_input_tag, MPI_COMM_WORLD, &requests[2 * i + 1]);
+    }
+
+    MPI_Waitall(requests.size(), requests.data(), MPI_STATUSES_IGNORE);
+}
+
+// Receive this rank's input from its server (client side)
+vector<int> receive_input(const io_layout& io)
+{
+    int count;
+    MPI_Recv(&count, 1, MPI_INT, io.server, io_input_tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    vector<int> values(count);
+    MPI_Recv(values.data(), count, MPI_INT, io.server, io_input_tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    return values;
+}
+
+// Post nonblocking sends of the results to the server in chunks, results and count must stay untouched until the requests complete
+void stream_results(const io_layout& io, const vector<float>& results, const int& count, vector<MPI_Request>& requests)
+{
+    requests.emplace_back();
+    MPI_Isend(&count, 1, MPI_INT, io.server, io_result_tag, MPI_COMM_WORLD, &requests.back());
+    for (int first = 0; first < count; first += io_chunk_elements)
+    {
+        requests.emplace_back();
+        MPI_Isend(results.data() + first, min(io_chunk_elements, count - first), MPI_FLOAT, io.server, io_result_tag, MPI_COMM_WORLD,
+            &requests.back());
+    }
+}
+
+// Receive the clients' results, format them and write every client's text as one sequential block at its place in the shared
+// text file (server side, collective over the servers), returns false on all servers if the file could not be written
+bool serve_output(const io_layout& io, const run_options& options)
+{
+    int io_rank;
+    int io_size;
+    MPI_Comm_rank(io.io_comm, &io_rank);
+    MPI_Comm_size(io.io_comm, &io_size);
+
+    // Every server fills in its clients' text sizes, the sum over servers is the size of every compute rank's text
+    vector<vector<string>> client_text(io.clients.size());
+    vector<long long> text_sizes(io.compute_size, 0);
+    vector<float> chunk(io_chunk_elements);
+
+    for (size_t i = 0; i < io.clients.size(); i++)
+    {
+        int count;
+        MPI_Recv(&count, 1, MPI_INT, io.clients[i], io_result_tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        for (int first = 0; first < count; first += io_chunk_elements)
+        {
+            int chunk_count = min(io_chunk_elements, count - first);
+            MPI_Recv(chunk.data(), chunk_count, MPI_FLOAT, io.clients[i], io_result_tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+
+            client_text[i].emplace_back();
+            format_results(chunk.data(), chunk_count, client_text[i].back());
+            text_sizes[io.client_compute_ranks[i]] += client_text[i].back().size();
+        }
+    }
+    double start_time = MPI_Wtime();
+    MPI_Allreduce(MPI_IN_PLACE, text_sizes.data(), io.compute_size, MPI_LONG_LONG, MPI_SUM, io.io_comm);
+
+    vector<long long> text_offsets(io.compute_size + 1, 0);
+    partial_sum(text_sizes.begin(), text_sizes.end(), text_offsets.begin() + 1);
+
+    MPI_File file;
+    if (MPI_File_open(io.io_comm, options.text_output_file.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS)
+    {
+        return false;
+    }
+    bool written = MPI_File_set_size(file, text_offsets.back()) == MPI_SUCCESS;
+
+    for (size_t i = 0; i < io.clients.size(); i++)
+    {
+        long long offset = text_offsets[io.client_compute_ranks[i]];
+        for (const string& text : client_text[i])
+        {
+            written = MPI_File_write_at(file, offset, text.data(), text.size(), MPI_CHAR, MPI_STATUS_IGNORE) == MPI_SUCCESS && written;
+            offset += text.size();
+        }
+    }
+    written = MPI_File_close(&file) == MPI_SUCCESS && written;
+    MPI_Allreduce(MPI_IN_PLACE, &written, 1, MPI_C_BOOL, MPI_LAND, io.io_comm);
+
+    double elapsed_time = MPI_Wtime() - start_time;
+    MPI_Reduce(io_rank == 0 ? MPI_IN_PLACE : &elapsed_time, &elapsed_time, 1, MPI_DOUBLE, MPI_MAX, 0, io.io_comm);
+    if (io_rank == 0 && written)
+    {
+        printf("\nIO:    %d I/O ranks wrote %lld bytes of %s for %d compute ranks in %.6f s\n",
+            io_size, text_offsets.back(), options.text_output_file.c_str(), io.compute_size, elapsed_time);
+    }
+    return written;
+}
+
+
+// Map a result file, check every block against its checksum and print the index (rank 0 only)
+// With range_count > 0 the results [range_first, range_first + range_count) are read with read_result_range and printed as well
+bool inspect_result_file(const string& path, int my_rank, long long range_first, long long range_count)
+{
+    result_file file;
+    if (!open_result_file(path, file))
+    {
+        fprintf(stderr, "%s is not a valid result file\n", path.c_str());
+        return false;
+    }
+
+    const result_file_header& header = *file.header;
+    printf("\nRESULTS %d:    %s holds %llu results from %llu ranks%s", my_rank, path.c_str(), (unsigned long long) header.total_elements,
+        (unsigned long long) header.total_ranks, (header.flags & RESULT_FILE_CHECKSUMS) ? " with block checksums" : "");
+
+    bool valid = true;
+    for (uint64_t rank = 0; rank < header.total_ranks; rank++)
+    {
+        uint64_t count;
+        const float* results = result_file_rank(file, rank, count);
+        bool block_valid = check_result_block(file, rank);
+        valid = valid && block_valid;
+
+        printf("\nRESULTS %d:    rank %llu: %llu results from element %llu at byte %llu%s", my_rank, (unsigned long long) rank,
+            (unsigned long long) count, (unsigned long long) file.index[rank].first_element, (unsigned long long) file.index[rank].data_offset,
+            block_valid ? "" : " CHECKSUM MISMATCH");
+        if (count > 0)
+        {
+            printf(", first %f last %f", results[0], results[count - 1]);
+        }
+    }
+
+    if (range_count > 0)
+    {
+        // Never more than the file holds, a longer range is rejected by read_result_range
+        vector<float> range(min<uint64_t>(range_count, header.total_elements));
+        if (!read_result_range(file, range_first, range_count, range.data()))
+        {
+            printf("\nRESULTS %d:    range of %lld results from element %lld is outside the file", my_rank, range_count, range_first);
+            valid = false;
+        }
+        else
+        {
+            printf("\nRESULTS %d:    results %lld to %lld: ", my_rank, range_first, range_first + range_count - 1);
+            for (long long i = 0; i < range_count; i++)
+            {
+                printf("%f ", range[i]);
+            }
+        }
+    }
+    printf("\n");
+
+    close_result_file(file);
+    return valid;
+}
+
+
+// Read the global results [first, first + count) back from the result file written by this run on rank 0 and compare them bit for bit
+// with the ranks' results (collective, the outcome is only valid on rank 0)
+bool check_result_range(const string& path, const vector<float>& final_results_array, long long first, long long count, int my_rank, MPI_Comm comm)
+{
+    int total_ranks;
+    MPI_Comm_size(comm, &total_ranks);
+
+    // This rank's part of the range
+    long long local_count = final_results_array.size();
+    long long offset = 0;
+    MPI_Exscan(&local_count, &offset, 1, MPI_LONG_LONG, MPI_SUM, comm);
+    offset = (my_rank == 0) ? 0 : offset;
+    long long begin = max(first, offset);
+    long long end = min(first + count, offset + local_count);
+    int part = max(0LL, end - begin);
+
+    vector<int> parts(total_ranks);
+    MPI_Gather(&part, 1, MPI_INT, parts.data(), 1, MPI_INT, 0, comm);
+    vector<int> displacements;
+    vector<float> expected;
+    if (my_rank == 0)
+    {
+        displacements = compute_displacements(parts);
+        expected.resize(displacements.back() + parts.back());
+    }
+    MPI_Gatherv(final_results_array.data() + (part > 0 ? begin - offset : 0), part, MPI_FLOAT, expected.data(), parts.data(), displacements.data(),
+        MPI_FLOAT, 0, comm);
+
+    if (my_rank != 0)
+    {
+        return true;
+    }
+
+    result_file file;
+    if (!open_result_file(path, file))
+    {
+        fprintf(stderr, "%s is not a valid result file\n", path.c_str());
+        return false;
+    }
+    vector<float> range(min<uint64_t>(count, file.header->total_elements));
+    bool inside = read_result_range(file, first, count, range.data());
+    close_result_file(file);
+
+    bool passed = inside && (long long) expected.size() == count && memcmp(range.data(), expected.data(), count * sizeof(float)) == 0;
+    printf("\nRESULTS %d:    %s, %lld results from element %lld read back from %s %s\n", my_rank, passed ? "PASSED" : "FAILED", count, first,
+        path.c_str(), inside ? (passed ? "match the results" : "differ from the results") : "are outside the file");
+    return passed;
+}
+
+
 int main(int argc, char** argv)
 {
     // Declare total_ranks and my_rank -> index of individual processor
@@ -48,198 +1951,614 @@ int main(int argc, char** argv)
     MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
 
 
-    // Create random number of elements in each process with random values in range 0-180 (theta)
-    srand(my_rank + time(NULL));
-    int num_elements = rand() % 10;
+    run_options options;
+    if (!parse_options(argc, argv, my_rank, options))
+    {
+        MPI_Finalize();
+        return 1;
+    }
+
+
+    if (options.stress_cases > 0)
+    {
+        // Without --seed every rank uses rank 0's clock so all ranks generate the same cases
+        unsigned int seed = (options.stress_seed != 0) ? options.stress_seed : time(NULL);
+        MPI_Bcast(&seed, 1, MPI_UNSIGNED, 0, MPI_COMM_WORLD);
+        options.stress_seed = seed;
+
+        bool passed = run_plan_stress_test(my_rank, total_ranks, options);
+        MPI_Finalize();
+        return passed ? 0 : 1;
+    }
+
+    if (!options.read_results_file.empty())
+    {
+        bool valid = (my_rank != 0) || inspect_result_file(options.read_results_file, my_rank, options.inspect_first, options.inspect_count);
+        MPI_Finalize();
+        return valid ? 0 : 1;
+    }
+
+
+    // Optionally reserve I/O ranks, the pipeline then runs on the compute ranks only (my_rank and total_ranks refer to compute_comm)
+    MPI_Comm compute_comm = MPI_COMM_WORLD;
+    io_layout io;
+    bool use_io_ranks = options.io_ranks_per_node > 0;
+    if (use_io_ranks)
+    {
+        io = setup_io_ranks(options.io_ranks_per_node);
+        if (io.is_server)
+        {
+            if (!options.input_file.empty())
+            {
+                serve_input(io, options);
+            }
+            bool written = options.text_output_file.empty() || serve_output(io, options);
+            MPI_Comm_free(&io.io_comm);
+            MPI_Finalize();
+            return written ? 0 : 1;
+        }
+
+        compute_comm = io.compute_comm;
+        MPI_Comm_size(compute_comm, &total_ranks);
+        MPI_Comm_rank(compute_comm, &my_rank);
+    }
 
 
     // All processes create their own elements stored in original_array
+    unsigned int seed = my_rank + time(NULL);
+    int recorded_count = -1;
+    if (!options.replay_file.empty())
+    {
+        replay_run(options.replay_file, seed, recorded_count, my_rank, total_ranks, options, compute_comm);
+    }
+
+    // A restarted run rebuilds the input it was checkpointed with
+    checkpoint_manifest restart_manifest = {};
+    bool has_checkpoint = false;
+    if (options.restart)
+    {
+        has_checkpoint = read_checkpoint(options.checkpoint_file, my_rank, restart_manifest) && restart_manifest.distribution >= 0 &&
+            restart_manifest.distribution <= 2;
+        if (has_checkpoint && options.input_file.empty())
+        {
+            seed = restart_manifest.seed;
+            options.max_elements = restart_manifest.max_elements;
+            options.distribution = distribution_names[restart_manifest.distribution];
+        }
+    }
+
     vector<int> original_array;
-    int theta;
-    for (int i = 0; i < num_elements; i++)
+    if (!options.input_file.empty() && use_io_ranks)
     {
-        theta = rand() % 181;
-        original_array.push_back(theta);
+        original_array = receive_input(io);
+    }
+    else if (!options.input_file.empty())
+    {
+        double start_time = MPI_Wtime();
+        size_t bytes_read;
+        string error;
+        if (!read_text_input(options.input_file, my_rank, total_ranks, original_array, bytes_read, error))
+        {
+            fprintf(stderr, "INPUT %d:    %s\n", my_rank, error.c_str());
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        double elapsed_time = MPI_Wtime() - start_time;
+
+        // Throughput of the whole read is limited by the slowest rank
+        double slowest_time;
+        long long total_bytes;
+        long long local_bytes = bytes_read;
+        MPI_Reduce(&elapsed_time, &slowest_time, 1, MPI_DOUBLE, MPI_MAX, 0, compute_comm);
+        MPI_Reduce(&local_bytes, &total_bytes, 1, MPI_LONG_LONG, MPI_SUM, 0, compute_comm);
+        if (my_rank == 0)
+        {
+            printf("\nINPUT %d:    Parsed %lld bytes of %s in %.6f s (%.0f MB/s)\n", my_rank, total_bytes, options.input_file.c_str(),
+                slowest_time, total_bytes / max(slowest_time, 1e-9) / 1e6);
+        }
+    }
+    else
+    {
+        original_array = generate_elements(my_rank, seed, options);
+    }
+    int num_elements = original_array.size();
+
+    if (recorded_count >= 0 && recorded_count != num_elements)
+    {
+        fprintf(stderr, "REPLAY %d:    Regenerated %d elements but the run log recorded %d\n", my_rank, num_elements, recorded_count);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    if (!options.record_file.empty())
+    {
+        record_run(options.record_file, seed, num_elements, my_rank, total_ranks, options, compute_comm);
     }
 
 
     // Print statements to check the initialized values in each process
-    printf("\nINITIALIZE %d:    Hello!, I am rank (processor index) %d of a total of %d processors with %d elements. My elements are:",
-        my_rank, my_rank, total_ranks, num_elements);
-    for (int i = 0; i < num_elements; i++)
+    if (!options.quiet)
     {
-        printf("%d ", original_array[i]);
+        printf("\nINITIALIZE %d:    Hello!, I am rank (processor index) %d of a total of %d processors with %d elements. My elements are:",
+            my_rank, my_rank, total_ranks, num_elements);
+        for (int i = 0; i < num_elements; i++)
+        {
+            printf("%d ", original_array[i]);
+        }
     }
-    
-
-    int total_elements;
-    // Collect all num_elements at master rank (assumed as rank 0)
-    vector<int> number_of_elements_array(total_ranks);  // buffer to store gathered information from all processes
-    MPI_Gather(&num_elements, 1, MPI_INT, number_of_elements_array.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);
 
 
-    if (my_rank == 0)
+    // Serve the blocks computed by earlier runs from the result cache, only the remaining elements go through the pipeline
+    bool use_cache = !options.cache_dir.empty();
+    vector<int> uncached_array;
+    vector<float> cached_results_array;
+    cache_lookup lookup;
+    double cache_lookup_time = 0.0;
+    if (use_cache)
     {
-        // Sum all members of number_of_elements_array to calculate total number of elements of interest (needed later)
-        total_elements = accumulate(number_of_elements_array.begin(), number_of_elements_array.end(), 0);
-        printf("\n\nTotal elements are %d", total_elements);
+        bool opened = open_result_cache(options.cache_dir);
+        MPI_Allreduce(MPI_IN_PLACE, &opened, 1, MPI_C_BOOL, MPI_LAND, compute_comm);
+        if (!opened)
+        {
+            if (my_rank == 0)
+            {
+                fprintf(stderr, "Cannot use result cache directory %s\n", options.cache_dir.c_str());
+            }
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+
+        double start_time = MPI_Wtime();
+        cached_results_array.resize(num_elements);
+        lookup_cached_results(options.cache_dir, task_kernel_id, original_array.data(), num_elements, options.cache_block_elements,
+            cached_results_array.data(), uncached_array, lookup);
+        cache_lookup_time = MPI_Wtime() - start_time;
     }
+    const vector<int>& pipeline_array = use_cache ? uncached_array : original_array;
 
 
-    // Displacements_array (array of index numbers where to store information from each process into buffer array)
-    // For ex: for number of elements to be sent array as {a, b, c, ...}
-    // The displacements will  be {0, a, a+b, a+b+c, ...} 
-    // These are needed for MPI_Gatherv/MPI_Scatterv function parameters
-    vector<int> displacements_array_2;
-    
+    // Run the pipeline, timing every iteration by its slowest rank
+    vector<float> final_results_array;
+    checkpoint_writer checkpoints;
+    int first_batch = 0;
+    int total_batches = 0;
+    if (options.batch_elements > 0)
+    {
+        int max_elements_per_rank;
+        MPI_Allreduce(&num_elements, &max_elements_per_rank, 1, MPI_INT, MPI_MAX, compute_comm);
+        total_batches = (max_elements_per_rank + options.batch_elements - 1) / options.batch_elements;
+    }
 
-    if  (my_rank == 0)
+    if (!options.checkpoint_file.empty())
     {
-        // Intialize new array with 0 (first index of buffer array)
-        displacements_array_2.push_back(0);
+        vector<int> all_counts(total_ranks);
+        MPI_Allgather(&num_elements, 1, MPI_INT, all_counts.data(), 1, MPI_INT, compute_comm);
+
+        checkpoint_manifest manifest = {};
+        memcpy(manifest.magic, checkpoint_magic, sizeof(manifest.magic));
+        manifest.version = checkpoint_version;
+        manifest.seed = seed;
+        manifest.max_elements = options.max_elements;
+        manifest.distribution = find(begin(distribution_names), end(distribution_names), options.distribution) - begin(distribution_names);
+        manifest.total_ranks = total_ranks;
+        manifest.element_count = num_elements;
+        manifest.batch_elements = options.batch_elements;
+        manifest.plan_hash = stream_plan_hash(all_counts, options.batch_elements);
+        manifest.results_checksum = result_block_checksum(nullptr, 0);
+        final_results_array.resize(num_elements);
+
+        if (options.restart)
+        {
+            // A checkpoint of another input or plan cannot be continued, a missing or damaged one only means starting over
+            bool matches = has_checkpoint && restart_manifest.total_ranks == manifest.total_ranks && restart_manifest.element_count == manifest.element_count &&
+                restart_manifest.batch_elements == manifest.batch_elements && restart_manifest.plan_hash == manifest.plan_hash;
+            if (has_checkpoint && !matches)
+            {
+                fprintf(stderr, "CHECKPOINT %d:    %s does not belong to this run (different input, batch size or number of ranks)\n", my_rank,
+                    checkpoint_manifest_path(options.checkpoint_file, my_rank).c_str());
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            }
+            bool restored = matches && restore_checkpoint(options.checkpoint_file, my_rank, restart_manifest, final_results_array.data());
+            if (has_checkpoint && !restored)
+            {
+                printf("\nCHECKPOINT %d:    Results of %s are damaged, this rank starts over\n", my_rank,
+                    checkpoint_manifest_path(options.checkpoint_file, my_rank).c_str());
+            }
 
-        for (int i = 0; i < total_ranks - 1; i++)
+            // The last consistent watermark: the batches every rank has checkpointed
+            int restored_batches = restored ? restart_manifest.batches_done : 0;
+            MPI_Allreduce(&restored_batches, &first_batch, 1, MPI_INT, MPI_MIN, compute_comm);
+            first_batch = min(first_batch, total_batches);
+
+            manifest.batches_done = first_batch;
+            manifest.watermark = min((long long) first_batch * options.batch_elements, (long long) num_elements);
+            manifest.results_checksum = result_block_checksum(final_results_array.data(), manifest.watermark);
+
+            long long local_watermark = manifest.watermark;
+            long long restored_elements;
+            MPI_Reduce(&local_watermark, &restored_elements, 1, MPI_LONG_LONG, MPI_SUM, 0, compute_comm);
+            if (my_rank == 0)
+            {
+                printf("\nCHECKPOINT %d:    Resuming %s at batch %d of %d, %lld results restored\n", my_rank, options.checkpoint_file.c_str(),
+                    first_batch, total_batches, restored_elements);
+            }
+        }
+
+        bool opened = open_checkpoints(checkpoints, options.checkpoint_file, my_rank, manifest, final_results_array.data());
+        MPI_Allreduce(MPI_IN_PLACE, &opened, 1, MPI_C_BOOL, MPI_LAND, compute_comm);
+        if (!opened)
         {
-            displacements_array_2.push_back(displacements_array_2[i] + number_of_elements_array[i]);
+            if (my_rank == 0)
+            {
+                fprintf(stderr, "Cannot create checkpoint files %s.<rank>\n", options.checkpoint_file.c_str());
+            }
+            MPI_Abort(MPI_COMM_WORLD, 1);
         }
     }
 
+    phase_checksums checksums;
+    compression_statistics compression_stats;
+    work_stealing_statistics scheduler_stats;
+    return_statistics return_stats;
 
-    // Create new buffer to store all elements *sequentially* from all processes in a single array
-    // For processes {A, B, C, ...}
-    // The stored elements array will be {a_1, a_2, ..., b_1, b_2, ..., c_1, c_2, ..., ...}
-    vector<int> combined_task_array(total_elements);
-    // Collect individual elements from all processes sequentially into a single array
-    MPI_Gatherv(original_array.data(), num_elements, MPI_INT,
-        combined_task_array.data(), number_of_elements_array.data(), displacements_array_2.data(), MPI_INT, 0, MPI_COMM_WORLD);
-    vector<int> redistributed_number_of_elements_array(total_ranks);
-    
-    MPI_Barrier(MPI_COMM_WORLD);
+    // With --result-chunk-elements every result chunk is consumed on its owner as soon as it lands
+    result_consumer consumer;
+    result_chunk_callback consume_chunk = [&consumer](const float* chunk, int first, int count)
+    {
+        consumer.consume(chunk, first, count);
+    };
+    const result_chunk_callback* on_chunk = (options.result_chunk_elements > 0) ? &consume_chunk : nullptr;
+    bool compress = options.compression.codec != CODEC_RAW || options.compression.adaptive;
 
-    if (my_rank == 0)
-    {    
-        printf("\n\nPROGRESS %d:    The number of elements in processes 0 to %d are: ", my_rank, total_ranks - 1);
-        for (int i = 0; i < total_ranks; i++)
+    if (options.compression.adaptive)
+    {
+        options.compression.codec = CODEC_RAW;
+
+        // Rank 0 sends to and receives from every rank, so its elements are the sample (or synthetic theta values if it has few)
+        const int min_sample = 4096;
+        const int synthetic_sample = 65536;
+        vector<int> sample = original_array;
+        if (sample.size() < min_sample)
         {
-            printf("%d ", number_of_elements_array[i]);
+            sample.resize(synthetic_sample);
+            for (int i = 0; i < synthetic_sample; i++)
+            {
+                sample[i] = rand() % 181;
+            }
         }
+        calibrate_compression(sample.data(), sample.size(), 0, compute_comm, options.compression, true);
+    }
 
-        printf("\nPROGRESS %d:    The sequential array of all elements is (from process 0 to %d): ", my_rank, total_ranks - 1);
-        for (int i = 0; i < total_elements; i++)
+    // With --dist-vector the layouts and exchange plans are set up once here, every iteration only moves data
+    unique_ptr<dist_vector<int>> resident_elements;
+    if (options.dist_vector)
+    {
+        resident_elements.reset(new dist_vector<int>(pipeline_array, plan_redistribution, compute_comm));
+
+        if (options.overlap)
         {
-            printf("%d ", combined_task_array[i]);
+            long long counts[2] = { resident_elements->retained_elements(), (long long) pipeline_array.size() };
+            long long totals[2];
+            MPI_Reduce(counts, totals, 2, MPI_LONG_LONG, MPI_SUM, 0, compute_comm);
+            if (my_rank == 0)
+            {
+                printf("\nOVERLAP %d:    %lld of %lld elements (%.1f%%) stay on their rank and are computed while the exchange is in flight\n", my_rank,
+                    totals[0], totals[1], totals[1] > 0 ? 100.0 * totals[0] / totals[1] : 0.0);
+            }
         }
+    }
 
-        // Next: distribute elements equally via process 0
-        // Create array to hold the number of elements in each process after redistribution
-        // For ex: if number_of_elements_array is {8, 1, 4, 7} redistribute as redistributed_number_of_elements_array being {5, 5, 5, 5}
-        //         if number_of_elements_array is {8, 2, 4, 7} redistribute as redistributed_number_of_elements_array being {6, 5, 5, 5}
-        //         if number_of_elements_array is {8, 3, 4, 7} redistribute as redistributed_number_of_elements_array being {6, 6, 5, 5}
+    double best_time = 0.0;
+    double total_time = 0.0;
 
-        // Redistribution
-        int base_avg = total_elements / total_ranks;
+    for (int iteration = 0; iteration < options.iterations; iteration++)
+    {
+        MPI_Barrier(compute_comm);
+        double start_time = MPI_Wtime();
+        consumer.start(start_time);
 
-        for (int i = 0; i < total_ranks; i++)
+        if (options.batch_elements > 0)
+        {
+            run_stream(pipeline_array, final_results_array, first_batch, total_batches, my_rank, total_ranks, options, options.checksum ? &checksums : nullptr,
+                compress ? &compression_stats : nullptr, &scheduler_stats, on_chunk, options.checkpoint_file.empty() ? nullptr : &checkpoints, compute_comm);
+        }
+        else if (!options.diffusion.empty())
+        {
+            run_diffusion(pipeline_array, final_results_array, my_rank, options, iteration == 0, compute_comm);
+        }
+        else if (options.dist_vector && options.overlap)
+        {
+            dist_vector<float> results = resident_elements->map_balanced<float>(task_kernel);
+            return_results(results, options.unordered_return, return_stats);
+            final_results_array.swap(results.local);
+        }
+        else if (options.dist_vector)
+        {
+            dist_vector<int> elements = *resident_elements;
+            elements.balance();
+            dist_vector<float> results = elements.map<float>(task_kernel);
+            return_results(results, options.unordered_return, return_stats);
+            final_results_array.swap(results.local);
+        }
+        else if (options.rma)
         {
-            redistributed_number_of_elements_array[i] = base_avg;
+            run_rma(pipeline_array, final_results_array, my_rank, iteration == 0, compute_comm);
+        }
+        else if (options.dataflow)
+        {
+            run_dataflow(pipeline_array, final_results_array, my_rank, iteration == 0, compute_comm);
+        }
+        else
+        {
+            run_pipeline(pipeline_array, final_results_array, my_rank, total_ranks, options, options.checksum ? &checksums : nullptr,
+                compress ? &compression_stats : nullptr, &scheduler_stats, on_chunk, compute_comm);
         }
 
-        int remainder = total_elements % total_ranks;
+        double elapsed_time = MPI_Wtime() - start_time;
+        double slowest_time;
+        MPI_Reduce(&elapsed_time, &slowest_time, 1, MPI_DOUBLE, MPI_MAX, 0, compute_comm);
 
-        for (int i = 0; i < remainder; i++)
+        if (my_rank == 0)
         {
-            redistributed_number_of_elements_array[i] += 1;
+            if (iteration == 0 || slowest_time < best_time)
+            {
+                best_time = slowest_time;
+            }
+            total_time += slowest_time;
         }
     }
 
 
-    int num_received_tasks;
-    // Scatter equalized number of elements that is needed in other processes
-    MPI_Scatter(redistributed_number_of_elements_array.data(), 1, MPI_INT, &num_received_tasks, 1, MPI_INT, 0, MPI_COMM_WORLD);
-
+    if (options.dataflow)
+    {
+        // A chain that needs no particular layout runs where the results are, without any redistribution
+        dataflow_graph summary(final_results_array, plan_redistribution, compute_comm);
+        summary.filter([](float result) { return result >= 0.5f; }, "x >= 0.5").map(kernel_x * kernel_x);
+        string plan = summary.describe();
 
-    // Again create displacements_array as a parameter to MPI_Scatterv
-    vector<int> displacements_array_3;
-    // Declare buffer to store task_array that will have elements on which the task needs to be performed
-    vector<int> task_array(num_received_tasks);
+        double count;
+        double sum_of_squares;
+        string error;
+        if (!summary.reduce(REDUCE_COUNT, count, error) || !summary.reduce(REDUCE_SUM, sum_of_squares, error))
+        {
+            if (my_rank == 0)
+            {
+                fprintf(stderr, "Dataflow summary cannot run: %s\n", error.c_str());
+            }
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        if (my_rank == 0)
+        {
+            printf("\nDATAFLOW %d:    summary plan: %s, %.0f results >= 0.5 with root mean square %f, %d redistributions\n", my_rank,
+                plan.c_str(), count, count > 0 ? sqrt(sum_of_squares / count) : 0.0, summary.redistributions);
+        }
+    }
 
+    if (use_cache)
+    {
+        // Merge the computed blocks between the cached ones and keep them for the next run
+        double start_time = MPI_Wtime();
+        string temporary_suffix = to_string(my_rank) + "." + to_string(getpid());
+        long long stored_blocks = store_computed_results(options.cache_dir, lookup, final_results_array.data(), cached_results_array.data(),
+            temporary_suffix);
+        final_results_array.swap(cached_results_array);
+        double cache_times[2] = { cache_lookup_time, MPI_Wtime() - start_time };
 
-    if (my_rank == 0)
-    {   
-        // Print redistributed array
-        printf("\nPROGRESS %d:    The targetted redistribution array is: ", my_rank);
-        for (int i = 0; i < total_ranks; i++)
+        long long local_totals[4] = { (long long) lookup.keys.size(), (long long) lookup.hit_blocks, (long long) lookup.hit_elements, stored_blocks };
+        long long totals[4];
+        double slowest_times[2];
+        MPI_Reduce(local_totals, totals, 4, MPI_LONG_LONG, MPI_SUM, 0, compute_comm);
+        MPI_Reduce(cache_times, slowest_times, 2, MPI_DOUBLE, MPI_MAX, 0, compute_comm);
+        if (my_rank == 0)
         {
-            printf("%d ", redistributed_number_of_elements_array[i]);
+            printf("\nCACHE %d:    %lld of %lld blocks served from %s (%lld results), %lld new blocks stored, lookup %.6f s, store %.6f s\n",
+                my_rank, totals[1], totals[0], options.cache_dir.c_str(), totals[2], totals[3], slowest_times[0], slowest_times[1]);
         }
-    
-        // Intialize new array with 0 (first index of buffer task_array)
-        displacements_array_3.push_back(0);
+    }
 
-        for (int i = 0; i < total_ranks - 1; i++)
+    if (!options.checkpoint_file.empty())
+    {
+        bool written = finish_checkpoints(checkpoints);
+        MPI_Allreduce(MPI_IN_PLACE, &written, 1, MPI_C_BOOL, MPI_LAND, compute_comm);
+        if (!written)
         {
-            displacements_array_3.push_back(displacements_array_3[i] + redistributed_number_of_elements_array[i]);
+            if (my_rank == 0)
+            {
+                fprintf(stderr, "Failed to write checkpoints %s.<rank>\n", options.checkpoint_file.c_str());
+            }
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        if (my_rank == 0)
+        {
+            printf("\nCHECKPOINT %d:    Wrote %d checkpoints of %d batches to %s.<rank>\n", my_rank, checkpoints.checkpoints, total_batches,
+                options.checkpoint_file.c_str());
         }
     }
 
-    MPI_Barrier(MPI_COMM_WORLD);
-    // Redistribute elements equally to perform a task
-    MPI_Scatterv(combined_task_array.data(), redistributed_number_of_elements_array.data(), displacements_array_3.data(), MPI_INT, task_array.data(),
-        num_received_tasks, MPI_INT, 0, MPI_COMM_WORLD);
 
-    
-    // Print statements to check the distributed elements
-    if (my_rank == 0)
+    // Print final results
+    if (!options.quiet)
     {
-        printf("\n");
+        printf("\nRESULT %d:    Hello! I am process %d and the final results are:", my_rank, my_rank);
+        for (int i = 0; i < num_elements; i++)
+        {
+            printf("%f ", final_results_array[i]);
+        }
     }
-    printf("\nTASK %d:    Hello! I am process %d and my task array is: ", my_rank, my_rank);
-    for (int i = 0; i < num_received_tasks; i++)
+
+
+    if (!options.write_results_file.empty())
     {
-        printf("%d ", task_array[i]);
+        double start_time = MPI_Wtime();
+        if (!write_result_file(options.write_results_file, final_results_array.data(), num_elements, options.result_checksums, compute_comm))
+        {
+            if (my_rank == 0)
+            {
+                fprintf(stderr, "Failed to write result file %s\n", options.write_results_file.c_str());
+            }
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        if (my_rank == 0)
+        {
+            printf("\nRESULTS %d:    Wrote %s in %.6f s\n", my_rank, options.write_results_file.c_str(), MPI_Wtime() - start_time);
+        }
     }
 
 
-    // Perform the task
-    vector<float> results_array(num_received_tasks);
+    // Text output is formatted here and keeps being written in the background during the reports and checks below
+    text_writer writer;
+    bool text_started = false;
+    double text_start_time = MPI_Wtime();
+    double text_format_time = 0.0;
+    vector<MPI_Request> io_requests;
+    if (!options.text_output_file.empty() && use_io_ranks)
+    {
+        stream_results(io, final_results_array, num_elements, io_requests);
+    }
+    else if (!options.text_output_file.empty())
+    {
+        text_started = start_text_output(writer, options.text_output_file, options.text_output_per_rank, final_results_array.data(),
+            num_elements, compute_comm);
+        text_format_time = MPI_Wtime() - text_start_time;
+    }
 
-    for (int i = 0; i < task_array.size(); i++)
+
+    if (compress)
     {
-        results_array[i] = sin(task_array[i] * atan(1) / 45.0);
+        // Sum of all ranks' messages over all iterations
+        long long local_totals[4] = { compression_stats.raw_bytes, compression_stats.wire_bytes,
+            compression_stats.compressed_messages, compression_stats.raw_messages };
+        long long totals[4];
+        MPI_Reduce(local_totals, totals, 4, MPI_LONG_LONG, MPI_SUM, 0, compute_comm);
+
+        if (my_rank == 0)
+        {
+            printf("\nCOMPRESS %d:    %s codec, %lld bytes sent as %lld bytes (ratio %.2f), %lld messages compressed, %lld sent raw\n",
+                my_rank, options.compression.adaptive ? "adaptive" : codec_names[options.compression.codec], totals[0], totals[1], totals[1] > 0 ? (double) totals[0] / totals[1] : 1.0,
+                totals[2], totals[3]);
+        }
     }
-    
 
-    // Gather results
-    vector<float> combined_results_array(total_elements);
-    MPI_Gatherv(results_array.data(), num_received_tasks, MPI_FLOAT,
-        combined_results_array.data(), redistributed_number_of_elements_array.data(), displacements_array_3.data(), MPI_FLOAT, 0, MPI_COMM_WORLD);
 
+    if (options.unordered_return)
+    {
+        long long local_totals[3] = { return_stats.chunks, return_stats.elements, return_stats.reordered_chunks };
+        long long totals[3];
+        MPI_Reduce(local_totals, totals, 3, MPI_LONG_LONG, MPI_SUM, 0, compute_comm);
+        if (my_rank == 0)
+        {
+            printf("\nRETURN %d:    %lld results in %lld chunks accepted in arrival order over %d iterations, %lld chunks after a chunk that follows them\n",
+                my_rank, totals[1], totals[0], options.iterations, totals[2]);
+        }
+    }
 
-    if (my_rank == 0)
+    if (options.result_chunk_elements > 0)
     {
-        // Print combined results array
-        printf("\n\nRESULT %d:    The combined results array is: ", my_rank);
-        for (int i = 0; i < total_elements; i++)
+        // Chunks of all runs, times and sums of the last run (a rank without results never sees a chunk)
+        long long local_counts[3] = { consumer.chunks, consumer.elements, consumer.out_of_order_chunks };
+        long long counts[3];
+        double local_times[2] = { consumer.first_chunk_time, consumer.last_chunk_time };
+        double times[2];
+        double sum;
+        MPI_Reduce(local_counts, counts, 3, MPI_LONG_LONG, MPI_SUM, 0, compute_comm);
+        MPI_Reduce(local_times, times, 2, MPI_DOUBLE, MPI_MAX, 0, compute_comm);
+        MPI_Reduce(&consumer.sum, &sum, 1, MPI_DOUBLE, MPI_SUM, 0, compute_comm);
+        if (my_rank == 0)
         {
-            printf("%f ", combined_results_array[i]);
+            printf("\nSTREAM %d:    %lld results consumed in %lld chunks as they arrived (%lld out of order), last run: all owners had their first "
+                "chunk after %.6f s and the last after %.6f s, sum of the results %.6f\n", my_rank, counts[1], counts[0], counts[2], times[0], times[1], sum);
         }
     }
 
+    if (options.threads > 1)
+    {
+        // Sum of all ranks' scheduled loops over all iterations
+        long long local_totals[6] = { scheduler_stats.loops, scheduler_stats.tasks, scheduler_stats.steals, scheduler_stats.steal_attempts,
+            scheduler_stats.busiest_thread_elements, scheduler_stats.elements };
+        long long totals[6];
+        MPI_Reduce(local_totals, totals, 6, MPI_LONG_LONG, MPI_SUM, 0, compute_comm);
 
-    vector<float> final_results_array(num_elements);
-    // Send back results to original processes;
-    MPI_Scatterv(combined_results_array.data(), number_of_elements_array.data(), displacements_array_2.data(), MPI_FLOAT, 
-        final_results_array.data(), num_elements, MPI_FLOAT, 0, MPI_COMM_WORLD);
+        // Only the pipeline schedules its task, the other modes leave the counters at zero
+        if (my_rank == 0 && totals[0] > 0)
+        {
+            // With perfect balance the busiest thread computes 1 / threads of every loop
+            printf("\nSCHEDULE %d:    %d threads per rank, %lld tasks in %lld loops, %lld steals of %lld attempts, busiest thread computed %.1f%% of the elements\n",
+                my_rank, options.threads, totals[1], totals[0], totals[2], totals[3], totals[5] > 0 ? 100.0 * totals[4] / totals[5] : 0.0);
+        }
+    }
 
 
-    // Print final results
-    printf("\nRESULT %d:    Hello! I am process %d and the final results are:", my_rank, my_rank);
-    for (int i = 0; i < num_elements; i++)
+    bool verified = true;
+    if (options.checksum)
+    {
+        verified = reconcile_checksums(checksums, my_rank, compute_comm);
+    }
+    if (options.verify)
+    {
+        verified = verify_results(original_array, final_results_array, my_rank, options, compute_comm) && verified;
+    }
+    if (options.stencil_radius > 0)
+    {
+        bool smoothed = smooth_results(final_results_array, options.stencil_radius, my_rank, options.verify, compute_comm);
+        MPI_Bcast(&smoothed, 1, MPI_C_BOOL, 0, compute_comm);
+        verified = smoothed && verified;
+    }
+    if (options.scan)
+    {
+        bool scanned = scan_results(final_results_array, my_rank, options.verify, compute_comm);
+        MPI_Bcast(&scanned, 1, MPI_C_BOOL, 0, compute_comm);
+        verified = scanned && verified;
+    }
+    if (!options.quantiles.empty() || options.top_k > 0)
+    {
+        bool selected = select_results(final_results_array, options, my_rank, compute_comm);
+        MPI_Bcast(&selected, 1, MPI_C_BOOL, 0, compute_comm);
+        verified = selected && verified;
+    }
+    if (options.verify && options.inspect_count > 0)
+    {
+        bool matched = check_result_range(options.write_results_file, final_results_array, options.inspect_first, options.inspect_count, my_rank,
+            compute_comm);
+        MPI_Bcast(&matched, 1, MPI_C_BOOL, 0, compute_comm);
+        verified = matched && verified;
+    }
+
+
+    if (use_io_ranks)
+    {
+        MPI_Waitall(io_requests.size(), io_requests.data(), MPI_STATUSES_IGNORE);
+    }
+    else if (!options.text_output_file.empty())
+    {
+        if (!finish_text_output(writer, text_started, compute_comm))
+        {
+            if (my_rank == 0)
+            {
+                fprintf(stderr, "Failed to write text output %s\n", options.text_output_file.c_str());
+            }
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+
+        double text_times[2] = { text_format_time, MPI_Wtime() - text_start_time };
+        double slowest_times[2];
+        MPI_Reduce(text_times, slowest_times, 2, MPI_DOUBLE, MPI_MAX, 0, compute_comm);
+        if (my_rank == 0)
+        {
+            printf("\nTEXT %d:    Wrote %s%s, formatting %.6f s, complete after %.6f s\n", my_rank, options.text_output_file.c_str(),
+                options.text_output_per_rank ? ".<rank>" : "", slowest_times[0], slowest_times[1]);
+        }
+    }
+
+
+    MPI_Barrier(compute_comm);
+    if (my_rank == 0 && options.iterations > 1)
     {
-        printf("%f ", final_results_array[i]);
+        printf("\nTIMING %d:    %d iterations, best %.6f s, mean %.6f s per pipeline run\n",
+            my_rank, options.iterations, best_time, total_time / options.iterations);
     }
 
 
+    if (use_io_ranks)
+    {
+        MPI_Comm_free(&compute_comm);
+    }
     MPI_Finalize();
 
+    return verified ? 0 : 1;
 }
@@ -0,0 +1,178 @@
+/*Element-wise kernels as expression templates
+-> A kernel is written as an ordinary formula of kernel_x, e.g. sin(deg2rad(kernel_x)) * w + c, and every operator or function
+   only builds a small object whose type records the whole formula, nothing is computed and nothing is allocated
+-> apply_kernel evaluates the formula for each element in one loop, all steps are inlined into the loop body, so chained
+   operations need no intermediate vectors and the compiler sees one straight-line expression per element
+-> Every step is evaluated in double and the result is converted to the output type once at the end
+-> The loop has no dependencies between iterations: with -O3 (and -ffast-math for sin, cos, exp and log, which glibc then takes
+   from its vector math library) the compiler vectorizes it
+-> describe() spells the formula out, e.g. "(sin(deg2rad(x)) * 2)", which identifies the kernel (the result cache keys on it)
+*/
+
+#ifndef MPI_KERNEL_H
+#define MPI_KERNEL_H
+
+#include <string>
+#include <cmath>
+#include <cstdio>
+#include <cstddef>
+
+
+// Base of all kernel expressions, E is the concrete expression type
+template <typename E>
+struct kernel_expression
+{
+    const E& derived() const
+    {
+        return static_cast<const E&>(*this);
+    }
+};
+
+// The element the kernel is applied to
+struct kernel_argument : kernel_expression<kernel_argument>
+{
+    double operator()(double x) const
+    {
+        return x;
+    }
+    std::string describe() const
+    {
+        return "x";
+    }
+};
+
+const kernel_argument kernel_x;
+
+struct kernel_constant : kernel_expression<kernel_constant>
+{
+    double value;
+
+    explicit kernel_constant(double value) : value(value)
+    {
+    }
+    double operator()(double) const
+    {
+        return value;
+    }
+    std::string describe() const
+    {
+        char text[32];
+        snprintf(text, sizeof(text), "%.17g", value);
+        return text;
+    }
+};
+
+template <typename F, typename E>
+struct kernel_unary : kernel_expression<kernel_unary<F, E>>
+{
+    E operand;
+
+    explicit kernel_unary(const E& operand) : operand(operand)
+    {
+    }
+    double operator()(double x) const
+    {
+        return F::apply(operand(x));
+    }
+    std::string describe() const
+    {
+        return std::string(F::name) + "(" + operand.describe() + ")";
+    }
+};
+
+template <typename F, typename L, typename R>
+struct kernel_binary : kernel_expression<kernel_binary<F, L, R>>
+{
+    L left;
+    R right;
+
+    kernel_binary(const L& left, const R& right) : left(left), right(right)
+    {
+    }
+    double operator()(double x) const
+    {
+        return F::apply(left(x), right(x));
+    }
+    std::string describe() const
+    {
+        return "(" + left.describe() + " " + F::name + " " + right.describe() + ")";
+    }
+};
+
+
+// Unary steps: a functor with apply and name, and the function that builds the expression
+#define KERNEL_UNARY_FUNCTION(function, formula)                                        \
+    struct kernel_##function                                                            \
+    {                                                                                   \
+        static constexpr const char* name = #function;                                  \
+        static double apply(double value)                                               \
+        {                                                                               \
+            return formula;                                                             \
+        }                                                                               \
+    };                                                                                  \
+    template <typename E>                                                               \
+    kernel_unary<kernel_##function, E> function(const kernel_expression<E>& operand)    \
+    {                                                                                   \
+        return kernel_unary<kernel_##function, E>(operand.derived());                   \
+    }
+
+KERNEL_UNARY_FUNCTION(sin, std::sin(value))
+KERNEL_UNARY_FUNCTION(cos, std::cos(value))
+KERNEL_UNARY_FUNCTION(tan, std::tan(value))
+KERNEL_UNARY_FUNCTION(exp, std::exp(value))
+KERNEL_UNARY_FUNCTION(log, std::log(value))
+KERNEL_UNARY_FUNCTION(sqrt, std::sqrt(value))
+KERNEL_UNARY_FUNCTION(abs, std::fabs(value))
+// Same operation order as the original task, theta * atan(1) / 45.0
+KERNEL_UNARY_FUNCTION(deg2rad, value * std::atan(1.0) / 45.0)
+KERNEL_UNARY_FUNCTION(rad2deg, value * 45.0 / std::atan(1.0))
+
+#undef KERNEL_UNARY_FUNCTION
+
+
+// Binary operators between two expressions or an expression and a number
+#define KERNEL_BINARY_OPERATOR(functor, symbol)                                                                          \
+    struct functor                                                                                                       \
+    {                                                                                                                    \
+        static constexpr const char* name = #symbol;                                                                     \
+        static double apply(double left, double right)                                                                   \
+        {                                                                                                                \
+            return left symbol right;                                                                                    \
+        }                                                                                                                \
+    };                                                                                                                   \
+    template <typename L, typename R>                                                                                    \
+    kernel_binary<functor, L, R> operator symbol(const kernel_expression<L>& left, const kernel_expression<R>& right)    \
+    {                                                                                                                    \
+        return kernel_binary<functor, L, R>(left.derived(), right.derived());                                            \
+    }                                                                                                                    \
+    template <typename L>                                                                                                \
+    kernel_binary<functor, L, kernel_constant> operator symbol(const kernel_expression<L>& left, double right)           \
+    {                                                                                                                    \
+        return kernel_binary<functor, L, kernel_constant>(left.derived(), kernel_constant(right));                       \
+    }                                                                                                                    \
+    template <typename R>                                                                                                \
+    kernel_binary<functor, kernel_constant, R> operator symbol(double left, const kernel_expression<R>& right)           \
+    {                                                                                                                    \
+        return kernel_binary<functor, kernel_constant, R>(kernel_constant(left), right.derived());                       \
+    }
+
+KERNEL_BINARY_OPERATOR(kernel_add, +)
+KERNEL_BINARY_OPERATOR(kernel_subtract, -)
+KERNEL_BINARY_OPERATOR(kernel_multiply, *)
+KERNEL_BINARY_OPERATOR(kernel_divide, /)
+
+#undef KERNEL_BINARY_OPERATOR
+
+
+// output[i] = kernel(input[i]) for count elements in one fused loop
+template <typename E, typename In, typename Out>
+inline void apply_kernel(const kernel_expression<E>& expression, const In* __restrict input, Out* __restrict output, size_t count)
+{
+    const E kernel = expression.derived();
+    for (size_t i = 0; i < count; i++)
+    {
+        output[i] = (Out) kernel((double) input[i]);
+    }
+}
+
+#endif
@@ -0,0 +1,98 @@
+/*One-sided redistribution with MPI windows
+-> Every rank exposes an array in an MPI window (MPI_Win_create), the other ranks read from it with MPI_Get or write into it with
+   MPI_Put without the owner posting a matching receive
+-> Both layouts of the sequence are known on every rank (see dist_layout in MPI_DistVector.h), so each rank works out by itself
+   which part of which peer's array overlaps its own range and at which displacement it lies there
+-> Transfers run inside one passive-target epoch per call (MPI_Win_lock_all with MPI_MODE_NOCHECK, as no rank ever takes an
+   exclusive lock), MPI_Win_unlock_all completes them at the origin and the collective MPI_Win_free makes sure every rank's
+   transfers are done before the exposed arrays are used again
+-> A single rank already holds everything in every layout and skips the window (not every MPI build can create one for it)
+-> rma_pull fetches this rank's range of the target layout from the ranks holding it in the source layout, rma_push writes this
+   rank's range of the source layout into the ranks holding it in the target layout, so the pipeline pulls its balanced
+   elements and pushes the results straight back into the owners' result arrays
+*/
+
+#ifndef MPI_ONE_SIDED_H
+#define MPI_ONE_SIDED_H
+
+#include <mpi.h>
+#include <vector>
+#include <algorithm>
+#include "MPI_DistVector.h"
+
+
+// Call transfer(peer, local position, peer position, count) for every part of this rank's range in mine that peer holds in theirs
+template <typename F>
+int for_each_overlap(const dist_layout& mine, const dist_layout& theirs, int my_rank, F transfer)
+{
+    int total_ranks = mine.counts.size();
+    long long first = mine.offsets[my_rank];
+    long long last = first + mine.counts[my_rank];
+    int transfers = 0;
+
+    for (int peer = 0; peer < total_ranks; peer++)
+    {
+        long long begin = std::max(first, (long long) theirs.offsets[peer]);
+        long long end = std::min(last, (long long) theirs.offsets[peer] + theirs.counts[peer]);
+        if (begin < end)
+        {
+            transfer(peer, begin - first, begin - theirs.offsets[peer], end - begin);
+            transfers++;
+        }
+    }
+    return transfers;
+}
+
+// This rank's range of the sequence in layout to, read with MPI_Get from every rank's exposed elements in layout from (collective)
+// transfers receives the number of MPI_Get calls this rank issued
+template <typename T>
+std::vector<T> rma_pull(const std::vector<T>& exposed, const dist_layout& from, const dist_layout& to, int& transfers, MPI_Comm comm)
+{
+    int my_rank;
+    MPI_Comm_rank(comm, &my_rank);
+    if (from.counts.size() == 1)
+    {
+        transfers = 0;
+        return exposed;
+    }
+    std::vector<T> pulled(to.counts[my_rank]);
+
+    // The window is only read from, MPI_Win_create just has no const overload
+    MPI_Win window;
+    MPI_Win_create(const_cast<T*>(exposed.data()), exposed.size() * sizeof(T), sizeof(T), MPI_INFO_NULL, comm, &window);
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, window);
+    transfers = for_each_overlap(to, from, my_rank, [&](int peer, long long position, long long peer_position, long long count)
+    {
+        MPI_Get(pulled.data() + position, count, dist_mpi_type<T>(), peer, peer_position, count, dist_mpi_type<T>(), window);
+    });
+    MPI_Win_unlock_all(window);
+    MPI_Win_free(&window);
+    return pulled;
+}
+
+// Write this rank's values (its range in layout from) with MPI_Put into every rank's exposed targets (its range in layout to),
+// targets must already hold the rank's count in layout to (collective), transfers receives the number of MPI_Put calls issued
+template <typename T>
+void rma_push(const std::vector<T>& values, const dist_layout& from, std::vector<T>& targets, const dist_layout& to, int& transfers, MPI_Comm comm)
+{
+    int my_rank;
+    MPI_Comm_rank(comm, &my_rank);
+    if (from.counts.size() == 1)
+    {
+        transfers = 0;
+        std::copy(values.begin(), values.end(), targets.begin());
+        return;
+    }
+
+    MPI_Win window;
+    MPI_Win_create(targets.data(), targets.size() * sizeof(T), sizeof(T), MPI_INFO_NULL, comm, &window);
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, window);
+    transfers = for_each_overlap(from, to, my_rank, [&](int peer, long long position, long long peer_position, long long count)
+    {
+        MPI_Put(values.data() + position, count, dist_mpi_type<T>(), peer, peer_position, count, dist_mpi_type<T>(), window);
+    });
+    MPI_Win_unlock_all(window);
+    MPI_Win_free(&window);
+}
+
+#endif
@@ -0,0 +1,196 @@
+/*Content-addressed result cache
+-> Every rank cuts its elements into blocks of cache_block_elements and keys each block by a 128-bit hash of its values and the
+   identifier of the kernel that computes the results, so a key names exactly one block of results
+-> Before redistribution every block is looked up in the cache directory, hits are copied straight into the results and only the
+   elements of missed blocks flow through the MPI pipeline, afterwards the missed blocks are stored for the next run
+-> Entries are files <directory>/<key>.bin: a 32-byte header (magic "MPICACHE", version, element count and the key again) followed by
+   the results as raw floats; they are written to a temporary file and renamed, so concurrent writers of one key never expose a torn entry
+-> The directory is meant to live on node-local storage, an entry that fails its header check counts as a miss
+*/
+
+#ifndef MPI_RESULT_CACHE_H
+#define MPI_RESULT_CACHE_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/stat.h>
+
+
+const char result_cache_magic[8] = { 'M', 'P', 'I', 'C', 'A', 'C', 'H', 'E' };
+const uint32_t result_cache_version = 1;
+
+struct cache_key
+{
+    uint64_t high;
+    uint64_t low;
+};
+
+struct result_cache_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t element_count;
+    cache_key key;
+};
+
+static_assert(sizeof(result_cache_header) == 32, "cache entry layout must not depend on padding");
+
+
+inline uint64_t mix_cache_hash(uint64_t x)
+{
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+// Two independent 64-bit hashes of the kernel identifier, the block length and the values
+inline cache_key block_cache_key(const int* values, size_t count, const std::string& kernel_id)
+{
+    uint64_t high = 0xCBF29CE484222325ull;
+    uint64_t low = 0x9E3779B97F4A7C15ull ^ count;
+    for (char c : kernel_id)
+    {
+        high = (high ^ (uint8_t) c) * 0x100000001B3ull;
+        low = mix_cache_hash(low + (uint8_t) c);
+    }
+    high = (high ^ count) * 0x100000001B3ull;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        uint32_t bits = values[i];
+        high = (high ^ bits) * 0x100000001B3ull;
+        low = mix_cache_hash(low + bits);
+    }
+    return { mix_cache_hash(high), low };
+}
+
+inline std::string cache_entry_path(const std::string& directory, const cache_key& key)
+{
+    char name[40];
+    snprintf(name, sizeof(name), "/%016llx%016llx.bin", (unsigned long long) key.high, (unsigned long long) key.low);
+    return directory + name;
+}
+
+// Read the entry of key into results, returns false when there is none or it does not hold count results for this key
+inline bool load_cached_block(const std::string& directory, const cache_key& key, size_t count, float* results)
+{
+    FILE* file = fopen(cache_entry_path(directory, key).c_str(), "rb");
+    if (file == NULL)
+    {
+        return false;
+    }
+    result_cache_header header;
+    bool valid = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, result_cache_magic, sizeof(header.magic)) == 0 &&
+        header.version == result_cache_version && header.element_count == count && header.key.high == key.high && header.key.low == key.low &&
+        fread(results, sizeof(float), count, file) == count;
+    fclose(file);
+    return valid;
+}
+
+// Store count results under key, temporary_suffix must be unique among all concurrent writers (e.g. the rank and process id)
+inline bool store_cached_block(const std::string& directory, const cache_key& key, const float* results, size_t count, const std::string& temporary_suffix)
+{
+    std::string path = cache_entry_path(directory, key);
+    std::string temporary_path = path + "." + temporary_suffix;
+
+    FILE* file = fopen(temporary_path.c_str(), "wb");
+    if (file == NULL)
+    {
+        return false;
+    }
+    result_cache_header header = {};
+    memcpy(header.magic, result_cache_magic, sizeof(header.magic));
+    header.version = result_cache_version;
+    header.element_count = count;
+    header.key = key;
+
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(results, sizeof(float), count, file) == count;
+    written = fclose(file) == 0 && written;
+    written = written && rename(temporary_path.c_str(), path.c_str()) == 0;
+    if (!written)
+    {
+        remove(temporary_path.c_str());
+    }
+    return written;
+}
+
+
+// Outcome of looking up all blocks of one rank
+struct cache_lookup
+{
+    size_t block_elements = 0;
+    size_t element_count = 0;
+    std::vector<cache_key> keys;
+    std::vector<bool> hit;
+    size_t hit_blocks = 0;
+    size_t hit_elements = 0;
+};
+
+// Look up every block of values, copy the hits into results (room for count floats) and append the elements of the missed
+// blocks to pending in order, they are the only ones that need computing
+inline void lookup_cached_results(const std::string& directory, const std::string& kernel_id, const int* values, size_t count, size_t block_elements,
+    float* results, std::vector<int>& pending, cache_lookup& lookup)
+{
+    lookup = cache_lookup();
+    lookup.block_elements = block_elements;
+    lookup.element_count = count;
+    pending.clear();
+
+    for (size_t first = 0; first < count; first += block_elements)
+    {
+        size_t length = std::min(block_elements, count - first);
+        cache_key key = block_cache_key(values + first, length, kernel_id);
+        bool hit = load_cached_block(directory, key, length, results + first);
+
+        lookup.keys.push_back(key);
+        lookup.hit.push_back(hit);
+        if (hit)
+        {
+            lookup.hit_blocks++;
+            lookup.hit_elements += length;
+        }
+        else
+        {
+            pending.insert(pending.end(), values + first, values + first + length);
+        }
+    }
+}
+
+// Move the computed results of the missed blocks (in pending order) into results and store them in the cache
+// Returns the number of blocks stored, a block that cannot be stored is simply computed again next time
+inline size_t store_computed_results(const std::string& directory, const cache_lookup& lookup, const float* computed, float* results,
+    const std::string& temporary_suffix)
+{
+    size_t stored = 0;
+    for (size_t block = 0; block < lookup.keys.size(); block++)
+    {
+        if (lookup.hit[block])
+        {
+            continue;
+        }
+        size_t first = block * lookup.block_elements;
+        size_t length = std::min(lookup.block_elements, lookup.element_count - first);
+        std::copy(computed, computed + length, results + first);
+        stored += store_cached_block(directory, lookup.keys[block], computed, length, temporary_suffix) ? 1 : 0;
+        computed += length;
+    }
+    return stored;
+}
+
+// Create the cache directory if it does not exist yet, returns false if it cannot be used
+inline bool open_result_cache(const std::string& directory)
+{
+    struct stat status;
+    if (mkdir(directory.c_str(), 0755) != 0 && (stat(directory.c_str(), &status) != 0 || !S_ISDIR(status.st_mode)))
+    {
+        return false;
+    }
+    return access(directory.c_str(), R_OK | W_OK | X_OK) == 0;
+}
+
+#endif
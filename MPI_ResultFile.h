@@ -0,0 +1,252 @@
+/*Binary result file
+-> One column of float results, written in parallel by all ranks with MPI-IO and read back without parsing through mmap
+-> Layout (native byte order):
+    -> header        - 64 bytes, see result_file_header
+    -> index         - one result_file_index_entry (32 bytes) per rank: where its block starts, how many results it holds,
+                       the global position of its first result and an optional checksum of the block
+    -> blocks        - every rank's results as a float array starting at a multiple of result_file_alignment
+-> Readers find any rank's block directly from the index, and any global element range with a binary search over first_element
+*/
+
+#ifndef MPI_RESULT_FILE_H
+#define MPI_RESULT_FILE_H
+
+#include <mpi.h>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+const char result_file_magic[8] = { 'M', 'P', 'I', 'R', 'E', 'S', 'L', 'T' };
+const uint32_t result_file_version = 1;
+const uint64_t result_file_alignment = 64;
+const uint32_t RESULT_FILE_CHECKSUMS = 1;
+
+struct result_file_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t total_ranks;
+    uint64_t total_elements;
+    uint64_t index_offset;
+    uint64_t alignment;
+    uint64_t reserved[2];
+};
+
+struct result_file_index_entry
+{
+    uint64_t data_offset;
+    uint64_t element_count;
+    uint64_t first_element;
+    uint64_t checksum;
+};
+
+static_assert(sizeof(result_file_header) == 64 && sizeof(result_file_index_entry) == 32, "result file layout must not depend on padding");
+
+
+inline uint64_t align_offset(uint64_t offset)
+{
+    return (offset + result_file_alignment - 1) / result_file_alignment * result_file_alignment;
+}
+
+// FNV-1a over the 32-bit words of a block, passing the checksum of the preceding words continues it over a longer block
+inline uint64_t result_block_checksum(const float* results, uint64_t count, uint64_t checksum = 0xCBF29CE484222325ull)
+{
+    for (uint64_t i = 0; i < count; i++)
+    {
+        uint32_t bits;
+        memcpy(&bits, &results[i], sizeof(bits));
+        checksum = (checksum ^ bits) * 0x100000001B3ull;
+    }
+    return checksum;
+}
+
+
+// Write every rank's results as its block of one result file (collective), returns false on all ranks if the file could not be written
+inline bool write_result_file(const std::string& path, const float* results, int count, bool checksums, MPI_Comm comm)
+{
+    int my_rank;
+    int total_ranks;
+    MPI_Comm_rank(comm, &my_rank);
+    MPI_Comm_size(comm, &total_ranks);
+
+    // Every rank builds the whole index, so no rank has to wait for another to learn its offset
+    result_file_index_entry my_entry = {};
+    my_entry.element_count = count;
+    my_entry.checksum = checksums ? result_block_checksum(results, count) : 0;
+
+    std::vector<result_file_index_entry> index(total_ranks);
+    MPI_Allgather(&my_entry, sizeof(my_entry), MPI_BYTE, index.data(), sizeof(my_entry), MPI_BYTE, comm);
+
+    uint64_t offset = align_offset(sizeof(result_file_header) + total_ranks * sizeof(result_file_index_entry));
+    uint64_t first_element = 0;
+    for (int i = 0; i < total_ranks; i++)
+    {
+        index[i].data_offset = offset;
+        index[i].first_element = first_element;
+        offset = align_offset(offset + index[i].element_count * sizeof(float));
+        first_element += index[i].element_count;
+    }
+
+    MPI_File file;
+    if (MPI_File_open(comm, path.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file) != MPI_SUCCESS)
+    {
+        return false;
+    }
+
+    // Drop whatever an older, longer file left behind
+    bool written = MPI_File_set_size(file, offset) == MPI_SUCCESS;
+
+    if (my_rank == 0)
+    {
+        result_file_header header = {};
+        memcpy(header.magic, result_file_magic, sizeof(header.magic));
+        header.version = result_file_version;
+        header.flags = checksums ? RESULT_FILE_CHECKSUMS : 0;
+        header.total_ranks = total_ranks;
+        header.total_elements = first_element;
+        header.index_offset = sizeof(result_file_header);
+        header.alignment = result_file_alignment;
+
+        written = MPI_File_write_at(file, 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE) == MPI_SUCCESS &&
+            MPI_File_write_at(file, header.index_offset, index.data(), total_ranks * sizeof(result_file_index_entry), MPI_BYTE,
+                MPI_STATUS_IGNORE) == MPI_SUCCESS && written;
+    }
+
+    written = MPI_File_write_at_all(file, index[my_rank].data_offset, results, count, MPI_FLOAT, MPI_STATUS_IGNORE) == MPI_SUCCESS && written;
+    written = MPI_File_close(&file) == MPI_SUCCESS && written;
+
+    MPI_Allreduce(MPI_IN_PLACE, &written, 1, MPI_C_BOOL, MPI_LAND, comm);
+    return written;
+}
+
+
+// Read-only memory mapping of a result file
+struct result_file
+{
+    const uint8_t* mapping = nullptr;
+    size_t size = 0;
+    const result_file_header* header = nullptr;
+    const result_file_index_entry* index = nullptr;
+};
+
+inline void close_result_file(result_file& file)
+{
+    if (file.mapping != nullptr)
+    {
+        munmap((void*) file.mapping, file.size);
+    }
+    file = result_file();
+}
+
+// Map a result file and check that its header and index describe blocks inside the file, returns false otherwise
+inline bool open_result_file(const std::string& path, result_file& file)
+{
+    int descriptor = open(path.c_str(), O_RDONLY);
+    struct stat status;
+    if (descriptor < 0 || fstat(descriptor, &status) != 0 || status.st_size < (off_t) sizeof(result_file_header))
+    {
+        if (descriptor >= 0)
+        {
+            close(descriptor);
+        }
+        return false;
+    }
+
+    void* mapping = mmap(nullptr, status.st_size, PROT_READ, MAP_SHARED, descriptor, 0);
+    close(descriptor);
+    if (mapping == MAP_FAILED)
+    {
+        return false;
+    }
+
+    file.mapping = (const uint8_t*) mapping;
+    file.size = status.st_size;
+    file.header = (const result_file_header*) file.mapping;
+
+    const result_file_header& header = *file.header;
+    bool valid = memcmp(header.magic, result_file_magic, sizeof(header.magic)) == 0 && header.version == result_file_version &&
+        header.index_offset >= sizeof(result_file_header) && header.index_offset <= file.size && header.index_offset % sizeof(uint64_t) == 0 &&
+        header.total_ranks <= (file.size - header.index_offset) / sizeof(result_file_index_entry);
+
+    if (valid)
+    {
+        file.index = (const result_file_index_entry*) (file.mapping + header.index_offset);
+        uint64_t next_element = 0;
+        for (uint64_t i = 0; valid && i < header.total_ranks; i++)
+        {
+            const result_file_index_entry& entry = file.index[i];
+            valid = entry.first_element == next_element && entry.data_offset % sizeof(float) == 0 && entry.data_offset <= file.size &&
+                entry.element_count <= (file.size - entry.data_offset) / sizeof(float);
+            next_element += entry.element_count;
+        }
+        valid = valid && next_element == header.total_elements;
+    }
+
+    if (!valid)
+    {
+        close_result_file(file);
+    }
+    return valid;
+}
+
+// Results of one rank, straight from the mapping
+inline const float* result_file_rank(const result_file& file, uint64_t rank, uint64_t& count)
+{
+    count = file.index[rank].element_count;
+    return (const float*) (file.mapping + file.index[rank].data_offset);
+}
+
+// True when the rank's block matches its recorded checksum (or the file was written without checksums)
+inline bool check_result_block(const result_file& file, uint64_t rank)
+{
+    if ((file.header->flags & RESULT_FILE_CHECKSUMS) == 0)
+    {
+        return true;
+    }
+    uint64_t count;
+    const float* results = result_file_rank(file, rank, count);
+    return result_block_checksum(results, count) == file.index[rank].checksum;
+}
+
+// Copy the global element range [first, first + count) into out, returns false if the range is outside the file
+inline bool read_result_range(const result_file& file, uint64_t first, uint64_t count, float* out)
+{
+    if (first > file.header->total_elements || count > file.header->total_elements - first)
+    {
+        return false;
+    }
+    if (count == 0)
+    {
+        return true;
+    }
+
+    // Last rank whose first element is not after first, skipping empty blocks
+    const result_file_index_entry* begin = file.index;
+    const result_file_index_entry* end = file.index + file.header->total_ranks;
+    const result_file_index_entry* entry = std::upper_bound(begin, end, first,
+        [](uint64_t element, const result_file_index_entry& candidate) { return element < candidate.first_element; }) - 1;
+
+    while (count > 0)
+    {
+        uint64_t offset = first - entry->first_element;
+        uint64_t available = std::min(count, entry->element_count - offset);
+        memcpy(out, (const float*) (file.mapping + entry->data_offset) + offset, available * sizeof(float));
+
+        out += available;
+        first += available;
+        count -= available;
+        entry++;
+    }
+    return true;
+}
+
+#endif
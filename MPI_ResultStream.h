@@ -0,0 +1,90 @@
+/*Streaming result return with per-chunk callbacks
+-> The last step of the pipeline (MPI_Scatterv of the results from rank 0 back to their owners) only hands the results over once
+   the whole call has completed, even though every owner's results are one contiguous block on rank 0
+-> scatter_result_chunks sends every owner's block in chunks of at most chunk_elements with nonblocking messages instead, the
+   first chunk of every owner before the second chunk of any, so all owners start receiving at once
+-> Owners post a receive per chunk and call the registered callback for every chunk as soon as MPI_Waitsome reports it complete,
+   with a pointer to the chunk inside the owner's result array and the chunk's position there, so downstream processing of the
+   first results overlaps with the transfer of the rest
+-> Chunks of one owner arrive in order (MPI does not let messages between the same pair overtake each other), rank 0 hands its
+   own chunks to the callback while its sends are in flight
+*/
+
+#ifndef MPI_RESULT_STREAM_H
+#define MPI_RESULT_STREAM_H
+
+#include <mpi.h>
+#include <vector>
+#include <functional>
+#include <algorithm>
+
+
+// Called on the owner for every chunk of its results as it lands: chunk points at owned[first], count results long
+typedef std::function<void(const float* chunk, int first, int count)> result_chunk_callback;
+
+const int result_chunk_tag = 400;
+
+
+// MPI_Scatterv of the results on root (every rank's counts and displacements, only significant on root) into owned, chunk by chunk,
+// calling on_chunk for each chunk on its owner as soon as it has arrived (collective)
+inline void scatter_result_chunks(const float* combined, const int* counts, const int* displacements, float* owned, int owned_count, int chunk_elements,
+    int root, MPI_Comm comm, const result_chunk_callback& on_chunk)
+{
+    int my_rank;
+    int total_ranks;
+    MPI_Comm_rank(comm, &my_rank);
+    MPI_Comm_size(comm, &total_ranks);
+    chunk_elements = std::max(1, chunk_elements);
+
+    std::vector<MPI_Request> requests;
+    if (my_rank == root)
+    {
+        // Round-robin over the owners, chunk c of every owner before chunk c + 1 of any
+        int most = *std::max_element(counts, counts + total_ranks);
+        for (int first = 0; first < most; first += chunk_elements)
+        {
+            for (int peer = 0; peer < total_ranks; peer++)
+            {
+                int count = std::min(chunk_elements, counts[peer] - first);
+                if (peer != root && count > 0)
+                {
+                    requests.emplace_back();
+                    MPI_Isend(combined + displacements[peer] + first, count, MPI_FLOAT, peer, result_chunk_tag, comm, &requests.back());
+                }
+            }
+        }
+
+        for (int first = 0; first < owned_count; first += chunk_elements)
+        {
+            int count = std::min(chunk_elements, owned_count - first);
+            std::copy(combined + displacements[root] + first, combined + displacements[root] + first + count, owned + first);
+            on_chunk(owned + first, first, count);
+        }
+        MPI_Waitall(requests.size(), requests.data(), MPI_STATUSES_IGNORE);
+        return;
+    }
+
+    std::vector<int> firsts;
+    for (int first = 0; first < owned_count; first += chunk_elements)
+    {
+        requests.emplace_back();
+        firsts.push_back(first);
+        MPI_Irecv(owned + first, std::min(chunk_elements, owned_count - first), MPI_FLOAT, root, result_chunk_tag, comm, &requests.back());
+    }
+
+    std::vector<int> completed(requests.size());
+    int remaining = requests.size();
+    while (remaining > 0)
+    {
+        int done;
+        MPI_Waitsome(requests.size(), requests.data(), &done, completed.data(), MPI_STATUSES_IGNORE);
+        for (int i = 0; i < done; i++)
+        {
+            int first = firsts[completed[i]];
+            on_chunk(owned + first, first, std::min(chunk_elements, owned_count - first));
+        }
+        remaining -= done;
+    }
+}
+
+#endif
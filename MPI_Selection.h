@@ -0,0 +1,218 @@
+/*Distributed selection: quantiles and top-k without gathering the data
+-> Every float is mapped to an unsigned key with the same order (order_key), the value of a given global rank in sorted order is then
+   found digit by digit, most significant byte first:
+    -> every rank counts its candidates per value of the next byte (a 256 bucket histogram)
+    -> the histograms are summed with one MPI_Allreduce and every rank finds the bucket holding the wanted rank
+    -> candidates outside that bucket are dropped locally, so later rounds only touch a shrinking share of the data
+-> Targets whose values share the bytes found so far share one candidate list, so the lists are disjoint and together never hold
+   more keys than the rank has values, and the first round reads the values directly without any copy
+-> Four rounds find the exact value for any number of elements, several ranks are selected together with one MPI_Allreduce per round
+-> Top-k selects the threshold value of rank total - k, then only the elements above it (at most k over all ranks) are gathered
+*/
+
+#ifndef MPI_SELECTION_H
+#define MPI_SELECTION_H
+
+#include <mpi.h>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <functional>
+
+
+// Unsigned key ordered like the floats: negative values reversed below the positive ones
+inline uint32_t order_key(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return (bits & 0x80000000u) ? ~bits : bits | 0x80000000u;
+}
+
+inline float key_value(uint32_t key)
+{
+    uint32_t bits = (key & 0x80000000u) ? key & 0x7FFFFFFFu : ~key;
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// Values at the given positions (0 = smallest, each below the global element count) of all ranks' values in sorted order (collective)
+inline std::vector<float> select_ranks(const std::vector<float>& values, const std::vector<long long>& positions, MPI_Comm comm)
+{
+    const int buckets = 256;
+    size_t targets = positions.size();
+
+    std::vector<uint32_t> prefixes(targets, 0);
+    std::vector<long long> remaining(positions);
+
+    // Targets whose prefixes agree share one candidate list (group), so the lists are disjoint; before the first round there is one
+    // group and every value is a candidate, read straight from values
+    std::vector<size_t> group(targets, 0);
+    std::vector<std::vector<uint32_t>> candidates;
+    size_t groups = 1;
+
+    for (int shift = 24; shift >= 0; shift -= 8)
+    {
+        std::vector<long long> local_histograms(groups * buckets, 0);
+        if (shift == 24)
+        {
+            for (float value : values)
+            {
+                local_histograms[order_key(value) >> 24]++;
+            }
+        }
+        else
+        {
+            for (size_t g = 0; g < groups; g++)
+            {
+                for (uint32_t key : candidates[g])
+                {
+                    local_histograms[g * buckets + ((key >> shift) & 0xFF)]++;
+                }
+            }
+        }
+        std::vector<long long> histograms(local_histograms.size());
+        MPI_Allreduce(local_histograms.data(), histograms.data(), histograms.size(), MPI_LONG_LONG, MPI_SUM, comm);
+
+        // The same on every rank: the bucket of each target and the groups of the new prefixes (in target order)
+        std::vector<size_t> next_group(targets);
+        std::vector<uint32_t> group_prefixes;
+        std::vector<long long> group_sizes;
+        std::vector<size_t> sources;
+        for (size_t target = 0; target < targets; target++)
+        {
+            const long long* histogram = &histograms[group[target] * buckets];
+            int bucket = 0;
+            while (bucket < buckets - 1 && remaining[target] >= histogram[bucket])
+            {
+                remaining[target] -= histogram[bucket];
+                bucket++;
+            }
+            prefixes[target] |= (uint32_t) bucket << shift;
+
+            size_t g = std::find(group_prefixes.begin(), group_prefixes.end(), prefixes[target]) - group_prefixes.begin();
+            if (g == group_prefixes.size())
+            {
+                group_prefixes.push_back(prefixes[target]);
+                group_sizes.push_back(local_histograms[group[target] * buckets + bucket]);
+                sources.push_back(group[target]);
+            }
+            next_group[target] = g;
+        }
+        if (shift == 0)
+        {
+            break;
+        }
+
+        // Keep the candidates whose bytes so far match each group's prefix, the local histogram gives the exact count
+        uint32_t mask = ~0u << shift;
+        std::vector<std::vector<uint32_t>> kept(group_prefixes.size());
+        for (size_t g = 0; g < group_prefixes.size(); g++)
+        {
+            kept[g].reserve(group_sizes[g]);
+            if (shift == 24)
+            {
+                for (float value : values)
+                {
+                    uint32_t key = order_key(value);
+                    if ((key & mask) == group_prefixes[g])
+                    {
+                        kept[g].push_back(key);
+                    }
+                }
+            }
+            else
+            {
+                for (uint32_t key : candidates[sources[g]])
+                {
+                    if ((key & mask) == group_prefixes[g])
+                    {
+                        kept[g].push_back(key);
+                    }
+                }
+            }
+        }
+        candidates.swap(kept);
+        group.swap(next_group);
+        groups = group_prefixes.size();
+    }
+
+    std::vector<float> selected(targets);
+    std::transform(prefixes.begin(), prefixes.end(), selected.begin(), key_value);
+    return selected;
+}
+
+// Quantiles of all ranks' values, quantile p is the value at position floor(p * (count - 1)) in sorted order (collective)
+// count receives the global element count, no quantile exists when it is 0
+inline std::vector<float> distributed_quantiles(const std::vector<float>& values, const std::vector<double>& probabilities, long long& count, MPI_Comm comm)
+{
+    long long local_count = values.size();
+    MPI_Allreduce(&local_count, &count, 1, MPI_LONG_LONG, MPI_SUM, comm);
+    if (count == 0)
+    {
+        return std::vector<float>(probabilities.size(), NAN);
+    }
+
+    std::vector<long long> positions;
+    for (double probability : probabilities)
+    {
+        positions.push_back(std::min(count - 1, (long long) std::floor(std::max(0.0, probability) * (count - 1))));
+    }
+    return select_ranks(values, positions, comm);
+}
+
+// The k largest values of all ranks in descending order on root (empty on the other ranks), fewer when there are fewer values (collective)
+inline std::vector<float> distributed_top_k(const std::vector<float>& values, long long k, int root, MPI_Comm comm)
+{
+    int my_rank;
+    int total_ranks;
+    MPI_Comm_rank(comm, &my_rank);
+    MPI_Comm_size(comm, &total_ranks);
+
+    long long local_count = values.size();
+    long long count;
+    MPI_Allreduce(&local_count, &count, 1, MPI_LONG_LONG, MPI_SUM, comm);
+    k = std::min(k, count);
+    if (k <= 0)
+    {
+        return std::vector<float>();
+    }
+
+    // Everything above the threshold belongs to the top k, the rest of the k are copies of the threshold
+    uint32_t threshold = order_key(select_ranks(values, std::vector<long long>(1, count - k), comm)[0]);
+    std::vector<float> above;
+    for (float value : values)
+    {
+        if (order_key(value) > threshold)
+        {
+            above.push_back(value);
+        }
+    }
+
+    int above_count = above.size();
+    std::vector<int> counts(my_rank == root ? total_ranks : 0);
+    MPI_Gather(&above_count, 1, MPI_INT, counts.data(), 1, MPI_INT, root, comm);
+
+    std::vector<int> displacements(counts.size(), 0);
+    std::vector<float> top;
+    if (my_rank == root)
+    {
+        for (int i = 1; i < total_ranks; i++)
+        {
+            displacements[i] = displacements[i - 1] + counts[i - 1];
+        }
+        top.resize(displacements.back() + counts.back());
+    }
+    MPI_Gatherv(above.data(), above_count, MPI_FLOAT, top.data(), counts.data(), displacements.data(), MPI_FLOAT, root, comm);
+
+    if (my_rank == root)
+    {
+        top.resize(k, key_value(threshold));
+        std::sort(top.begin(), top.end(), [](float a, float b) { return order_key(a) > order_key(b); });
+    }
+    return top;
+}
+
+#endif
@@ -0,0 +1,306 @@
+/*Text input and output for the pipeline
+Input:
+-> Every rank memory-maps the shared input file and parses only its own byte range [rank * size / ranks, (rank + 1) * size / ranks)
+-> A line belongs to the rank whose range holds its first byte, so ranges are moved to line starts and no line is read twice
+-> Values are whitespace separated angles, parsed with std::from_chars (integers directly, decimals rounded to the nearest integer)
+-> Splitting by bytes also spreads the elements roughly evenly before any redistribution
+Output:
+-> Results are rendered one per line with std::to_chars (same digits as printf("%f")) into large chunks
+-> Per-rank files are written by a background thread while the remaining chunks are still being formatted
+-> A shared file holds the ranks' text in rank order, every rank writes its chunks at an offset taken from MPI_Exscan of the
+   text sizes with nonblocking MPI_File_iwrite_at, so no MPI calls are made from another thread
+*/
+
+#ifndef MPI_TEXT_IO_H
+#define MPI_TEXT_IO_H
+
+#include <mpi.h>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstdio>
+#include <cmath>
+#include <charconv>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+// First byte of the first line starting at or after offset
+inline size_t next_line_start(const char* data, size_t size, size_t offset)
+{
+    while (offset > 0 && offset < size && data[offset - 1] != '\n')
+    {
+        offset++;
+    }
+    return offset;
+}
+
+// floor(size * rank / total_ranks) without overflowing for large files
+inline size_t range_boundary(size_t size, int rank, int total_ranks)
+{
+    return size / total_ranks * rank + size % total_ranks * rank / total_ranks;
+}
+
+inline bool is_separator(char c)
+{
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == ',';
+}
+
+// Parse the values in [begin, end) into values, returns the offset of the first malformed token or -1 when all parsed
+inline long parse_angles(const char* begin, const char* end, std::vector<int>& values)
+{
+    const char* position = begin;
+    while (true)
+    {
+        while (position < end && is_separator(*position))
+        {
+            position++;
+        }
+        if (position == end)
+        {
+            return -1;
+        }
+
+        int value;
+        std::from_chars_result parsed = std::from_chars(position, end, value);
+        if (parsed.ec == std::errc() && (parsed.ptr == end || is_separator(*parsed.ptr)))
+        {
+            values.push_back(value);
+            position = parsed.ptr;
+            continue;
+        }
+
+        // Not a plain integer, try a decimal such as 45.5 or 1e2
+        double decimal;
+        parsed = std::from_chars(position, end, decimal);
+        if (parsed.ec != std::errc() || (parsed.ptr != end && !is_separator(*parsed.ptr)) || std::fabs(decimal) > 2147483647.0)
+        {
+            return position - begin;
+        }
+        values.push_back((int) std::lround(decimal));
+        position = parsed.ptr;
+    }
+}
+
+// Read this rank's share of a text file of angles, together all ranks of total_ranks read every value exactly once
+// Returns false with a message in error when the file cannot be mapped or holds a malformed value
+inline bool read_text_input(const std::string& path, int my_rank, int total_ranks, std::vector<int>& values, size_t& bytes_read, std::string& error)
+{
+    values.clear();
+    bytes_read = 0;
+
+    int descriptor = open(path.c_str(), O_RDONLY);
+    struct stat status;
+    if (descriptor < 0 || fstat(descriptor, &status) != 0)
+    {
+        if (descriptor >= 0)
+        {
+            close(descriptor);
+        }
+        error = "cannot open " + path;
+        return false;
+    }
+
+    size_t size = status.st_size;
+    if (size == 0)
+    {
+        close(descriptor);
+        return true;
+    }
+
+    // The whole file is mapped so a range can run to the end of its last line, only the pages of this range are touched
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    close(descriptor);
+    if (mapping == MAP_FAILED)
+    {
+        error = "cannot map " + path;
+        return false;
+    }
+    const char* data = (const char*) mapping;
+
+    size_t begin = next_line_start(data, size, range_boundary(size, my_rank, total_ranks));
+    size_t end = next_line_start(data, size, range_boundary(size, my_rank + 1, total_ranks));
+    madvise((void*) (data + begin / 4096 * 4096), end - begin / 4096 * 4096, MADV_SEQUENTIAL);
+
+    // Angles of up to three digits plus a separator take about four bytes each
+    values.reserve((end - begin) / 4);
+    long malformed = parse_angles(data + begin, data + end, values);
+    bytes_read = end - begin;
+
+    if (malformed >= 0)
+    {
+        error = path + ": malformed value at byte " + std::to_string(begin + malformed);
+    }
+
+    munmap(mapping, size);
+    return malformed < 0;
+}
+
+
+const size_t text_chunk_bytes = 4 << 20;
+// Longest "%f" rendering of a float (3.4e38 has 39 integer digits) plus sign, point, 6 decimals and newline
+const size_t max_formatted_result = 48;
+
+// Append count results to chunk as "%f\n" lines
+inline void format_results(const float* results, size_t count, std::string& chunk)
+{
+    size_t length = chunk.size();
+    chunk.resize(length + count * max_formatted_result);
+    char* position = &chunk[length];
+    char* end = &chunk[0] + chunk.size();
+
+    for (size_t i = 0; i < count; i++)
+    {
+        position = std::to_chars(position, end, results[i], std::chars_format::fixed, 6).ptr;
+        *position++ = '\n';
+    }
+    chunk.resize(position - &chunk[0]);
+}
+
+
+struct text_writer
+{
+    // Per-rank file: chunks queued for the background thread
+    FILE* file = nullptr;
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<std::string> queue;
+    bool closing = false;
+    bool failed = false;            // also set when sizing the shared file failed
+
+    // Shared file: chunks stay alive until their nonblocking writes complete
+    bool shared = false;
+    MPI_File shared_file;
+    std::vector<std::string> chunks;
+    std::vector<MPI_Request> requests;
+};
+
+inline void write_queued_chunks(text_writer* writer)
+{
+    std::unique_lock<std::mutex> lock(writer->mutex);
+    while (true)
+    {
+        writer->ready.wait(lock, [writer] { return writer->closing || !writer->queue.empty(); });
+        if (writer->queue.empty())
+        {
+            return;
+        }
+
+        std::string chunk = std::move(writer->queue.front());
+        writer->queue.pop_front();
+
+        lock.unlock();
+        bool written = fwrite(chunk.data(), 1, chunk.size(), writer->file) == chunk.size();
+        lock.lock();
+        writer->failed = writer->failed || !written;
+    }
+}
+
+// Format the results and start writing them to path (shared, in rank order) or to path.<rank> (per_rank) (collective)
+// Returns when all text is formatted, the writes continue in the background until finish_text_output
+inline bool start_text_output(text_writer& writer, const std::string& path, bool per_rank, const float* results, size_t count, MPI_Comm comm)
+{
+    int my_rank;
+    MPI_Comm_rank(comm, &my_rank);
+    size_t results_per_chunk = text_chunk_bytes / max_formatted_result;
+
+    if (per_rank)
+    {
+        std::string rank_path = path + "." + std::to_string(my_rank);
+        writer.file = fopen(rank_path.c_str(), "wb");
+        if (writer.file == NULL)
+        {
+            return false;
+        }
+        writer.thread = std::thread(write_queued_chunks, &writer);
+
+        for (size_t first = 0; first < count; first += results_per_chunk)
+        {
+            std::string chunk;
+            format_results(results + first, std::min(results_per_chunk, count - first), chunk);
+
+            std::lock_guard<std::mutex> lock(writer.mutex);
+            writer.queue.push_back(std::move(chunk));
+            writer.ready.notify_one();
+        }
+        return true;
+    }
+
+    writer.shared = true;
+    long long text_bytes = 0;
+    for (size_t first = 0; first < count; first += results_per_chunk)
+    {
+        writer.chunks.emplace_back();
+        format_results(results + first, std::min(results_per_chunk, count - first), writer.chunks.back());
+        text_bytes += writer.chunks.back().size();
+    }
+
+    long long offset = 0;
+    long long total_bytes = 0;
+    MPI_Exscan(&text_bytes, &offset, 1, MPI_LONG_LONG, MPI_SUM, comm);
+    MPI_Allreduce(&text_bytes, &total_bytes, 1, MPI_LONG_LONG, MPI_SUM, comm);
+    offset = (my_rank == 0) ? 0 : offset;
+
+    bool opened = MPI_File_open(comm, path.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &writer.shared_file) == MPI_SUCCESS;
+    if (!opened)
+    {
+        writer.shared = false;
+        return false;
+    }
+    // Drop whatever an older, longer file left behind, a failure is reported by finish_text_output (the writes and the close
+    // below are collective or paired with it, so every rank still goes through them)
+    writer.failed = MPI_File_set_size(writer.shared_file, total_bytes) != MPI_SUCCESS;
+
+    for (std::string& chunk : writer.chunks)
+    {
+        writer.requests.emplace_back();
+        MPI_File_iwrite_at(writer.shared_file, offset, chunk.data(), chunk.size(), MPI_CHAR, &writer.requests.back());
+        offset += chunk.size();
+    }
+    return true;
+}
+
+// Wait for all writes and close the file (collective), returns false on every rank if any rank failed
+inline bool finish_text_output(text_writer& writer, bool started, MPI_Comm comm)
+{
+    bool written = started;
+
+    if (writer.thread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(writer.mutex);
+            writer.closing = true;
+            writer.ready.notify_one();
+        }
+        writer.thread.join();
+        written = !writer.failed && written;
+    }
+    if (writer.file != NULL)
+    {
+        written = fclose(writer.file) == 0 && written;
+        writer.file = NULL;
+    }
+
+    if (writer.shared)
+    {
+        std::vector<MPI_Status> statuses(writer.requests.size());
+        written = !writer.failed && written;
+        written = MPI_Waitall(writer.requests.size(), writer.requests.data(), statuses.data()) == MPI_SUCCESS && written;
+        written = MPI_File_close(&writer.shared_file) == MPI_SUCCESS && written;
+        writer.chunks.clear();
+        writer.requests.clear();
+        writer.shared = false;
+    }
+
+    MPI_Allreduce(MPI_IN_PLACE, &written, 1, MPI_C_BOOL, MPI_LAND, comm);
+    return written;
+}
+
+#endif
@@ -0,0 +1,248 @@
+/*Work-stealing thread scheduler for the compute stage of one rank
+-> parallel_for_stealing splits a loop of count elements over the given number of threads: each thread starts with a contiguous
+   share in its own deque, takes ranges from the bottom of it and splits every range larger than the grain in halves, keeping
+   the lower half and pushing the upper one
+-> A thread whose deque is empty steals from the top of a random other thread's deque, which holds the oldest and largest
+   ranges, so a thread that finished its cheap elements takes over half of a slower thread's remaining work
+-> The deques are Chase–Lev deques: the owner pushes and pops at the bottom without any atomic read-modify-write, thieves
+   only compete with a compare-and-swap on top (and with the owner for the very last range)
+-> Capacity: a range is only pushed as the upper half of a range longer than the grain, so it is longer than grain / 2, and
+   the ranges in one deque are disjoint, so at most 2 * count / grain of them fit; a thread pushes only after popping its
+   initial share, so that share adds at most 1 and a fixed capacity of 2 * count / grain + 1 ranges never overflows
+-> A thread whose steal fails yields, and after steal_spin_attempts failures in a row sleeps for a growing time (up to
+   steal_max_backoff_us), so idle threads stop competing for the core once little work is left; each call creates and joins
+   its threads (tens of microseconds), so loops much shorter than that are better run on one thread
+-> The counters each thread updates (tasks, steals, elements) and the ends of every deque sit on their own cache lines, so
+   threads never invalidate each other's lines except when they really steal
+*/
+
+#ifndef MPI_WORK_STEALING_H
+#define MPI_WORK_STEALING_H
+
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <random>
+#include <cstddef>
+#include <algorithm>
+
+
+constexpr size_t cache_line_bytes = 64;
+
+// Failed steals in a row before an idle thread starts sleeping, and the longest sleep
+const int steal_spin_attempts = 64;
+const int steal_max_backoff_us = 64;
+
+struct work_range
+{
+    size_t begin;
+    size_t end;
+};
+
+// One deque entry, written by the owner and read by thieves, hence atomic fields (only relaxed accesses, the ends order them)
+struct work_slot
+{
+    std::atomic<size_t> begin{0};
+    std::atomic<size_t> end{0};
+};
+
+struct work_deque
+{
+    std::vector<work_slot> slots;   // capacity is a power of two
+    size_t mask = 0;
+    alignas(cache_line_bytes) std::atomic<long long> top{0};
+    alignas(cache_line_bytes) std::atomic<long long> bottom{0};
+
+    void reserve(size_t capacity)
+    {
+        size_t size = 1;
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+        std::vector<work_slot>(size).swap(slots);
+        mask = size - 1;
+    }
+
+    // Owner only
+    void push(work_range range)
+    {
+        long long b = bottom.load(std::memory_order_relaxed);
+        work_slot& slot = slots[b & mask];
+        slot.begin.store(range.begin, std::memory_order_relaxed);
+        slot.end.store(range.end, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    // Owner only, takes the newest range
+    bool pop(work_range& range)
+    {
+        long long b = bottom.load(std::memory_order_relaxed) - 1;
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        long long t = top.load(std::memory_order_relaxed);
+        if (t > b)
+        {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+
+        range = read(b);
+        if (t < b)
+        {
+            return true;
+        }
+        // The last range, a thief may be taking it at the same time
+        bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return won;
+    }
+
+    // Any other thread, takes the oldest range, fails when the deque is empty or another thread got the range first
+    bool steal(work_range& range)
+    {
+        long long t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        long long b = bottom.load(std::memory_order_acquire);
+        if (t >= b)
+        {
+            return false;
+        }
+        range = read(t);
+        return top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    }
+
+    work_range read(long long index) const
+    {
+        const work_slot& slot = slots[index & mask];
+        return { slot.begin.load(std::memory_order_relaxed), slot.end.load(std::memory_order_relaxed) };
+    }
+};
+
+// What one thread did, alone on its cache line(s)
+struct alignas(cache_line_bytes) work_counters
+{
+    long long tasks = 0;
+    long long elements = 0;
+    long long steals = 0;
+    long long steal_attempts = 0;
+};
+
+struct work_stealing_statistics
+{
+    long long loops = 0;
+    long long tasks = 0;
+    long long steals = 0;
+    long long steal_attempts = 0;
+    long long busiest_thread_elements = 0;  // sum over the loops of the largest share one thread computed
+    long long elements = 0;
+};
+
+
+// Run body(begin, end) over [0, count) on threads threads (the calling thread is one of them) in ranges of at most grain
+// elements, the ranges are disjoint and cover every element once; statistics are added to stats when it is not null
+template <typename F>
+void parallel_for_stealing(size_t count, int threads, size_t grain, F body, work_stealing_statistics* stats = nullptr)
+{
+    threads = std::max(1, threads);
+    grain = std::max<size_t>(1, grain);
+
+    std::vector<work_deque> deques(threads);
+    std::vector<work_counters> counters(threads);
+    struct alignas(cache_line_bytes) padded_counter
+    {
+        std::atomic<size_t> value;
+    } remaining;
+    remaining.value.store(count, std::memory_order_relaxed);
+
+    for (int id = 0; id < threads; id++)
+    {
+        deques[id].reserve(2 * count / grain + 1);
+        size_t begin = count * id / threads;
+        size_t end = count * (id + 1) / threads;
+        if (end > begin)
+        {
+            deques[id].push({ begin, end });
+        }
+    }
+
+    auto worker = [&](int id)
+    {
+        std::minstd_rand random(id + 1);
+        work_deque& own = deques[id];
+        work_counters& counter = counters[id];
+        work_range range;
+        int failed_steals = 0;
+
+        while (remaining.value.load(std::memory_order_acquire) > 0)
+        {
+            if (!own.pop(range))
+            {
+                if (threads == 1)
+                {
+                    continue;
+                }
+                int victim = random() % (threads - 1);
+                victim += (victim >= id) ? 1 : 0;
+                counter.steal_attempts++;
+                if (!deques[victim].steal(range))
+                {
+                    failed_steals++;
+                    if (failed_steals < steal_spin_attempts)
+                    {
+                        std::this_thread::yield();
+                    }
+                    else
+                    {
+                        int shift = std::min(failed_steals - steal_spin_attempts, 6);
+                        std::this_thread::sleep_for(std::chrono::microseconds(std::min(1 << shift, steal_max_backoff_us)));
+                    }
+                    continue;
+                }
+                failed_steals = 0;
+                counter.steals++;
+            }
+
+            while (range.end - range.begin > grain)
+            {
+                size_t middle = range.begin + (range.end - range.begin) / 2;
+                own.push({ middle, range.end });
+                range.end = middle;
+            }
+            body(range.begin, range.end);
+            counter.tasks++;
+            counter.elements += range.end - range.begin;
+            remaining.value.fetch_sub(range.end - range.begin, std::memory_order_acq_rel);
+        }
+    };
+
+    std::vector<std::thread> helpers;
+    for (int id = 1; id < threads; id++)
+    {
+        helpers.emplace_back(worker, id);
+    }
+    worker(0);
+    for (std::thread& helper : helpers)
+    {
+        helper.join();
+    }
+
+    if (stats != nullptr)
+    {
+        long long busiest = 0;
+        for (const work_counters& counter : counters)
+        {
+            stats->tasks += counter.tasks;
+            stats->steals += counter.steals;
+            stats->steal_attempts += counter.steal_attempts;
+            busiest = std::max(busiest, counter.elements);
+        }
+        stats->loops++;
+        stats->busiest_thread_elements += busiest;
+        stats->elements += count;
+    }
+}
+
+#endif